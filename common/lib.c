@@ -16,6 +16,8 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/stat.h>
@@ -131,3 +133,76 @@ char *slurp_file(const char *filename, off_t * r_size)
 	return buf;
 }
 
+
+#if __BYTE_ORDER == __LITTLE_ENDIAN && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_SIMD_BSWAP
+#include <immintrin.h>
+
+/*
+ * Byte-swaps 8 words per iteration. Returns the number of words done.
+ */
+__attribute__ ((target("avx2")))
+static size_t bswap32_array_avx2(uint32_t *dst, const uint8_t *src,
+				 size_t count)
+{
+	const __m256i mask = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4,
+					      11, 10, 9, 8, 15, 14, 13, 12,
+					      3, 2, 1, 0, 7, 6, 5, 4,
+					      11, 10, 9, 8, 15, 14, 13, 12);
+	__m256i v;
+	size_t i;
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		v = _mm256_loadu_si256((const __m256i *)(src + 4 * i));
+		_mm256_storeu_si256((__m256i *)(dst + i),
+				    _mm256_shuffle_epi8(v, mask));
+	}
+	return i;
+}
+
+/*
+ * Byte-swaps 4 words per iteration. Returns the number of words done.
+ */
+__attribute__ ((target("ssse3")))
+static size_t bswap32_array_ssse3(uint32_t *dst, const uint8_t *src,
+				  size_t count)
+{
+	const __m128i mask = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4,
+					   11, 10, 9, 8, 15, 14, 13, 12);
+	__m128i v;
+	size_t i;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		v = _mm_loadu_si128((const __m128i *)(src + 4 * i));
+		_mm_storeu_si128((__m128i *)(dst + i),
+				 _mm_shuffle_epi8(v, mask));
+	}
+	return i;
+}
+#endif
+
+/*
+ * Converts count big endian words at src (no alignment required)
+ * to cpu order words at dst.
+ */
+void be32_to_cpu_array(uint32_t *dst, const void *src, size_t count)
+{
+	const uint8_t *s = src;
+	uint32_t val;
+	size_t i = 0;
+
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+#ifdef HAVE_SIMD_BSWAP
+	if (__builtin_cpu_supports("avx2"))
+		i = bswap32_array_avx2(dst, s, count);
+	else if (__builtin_cpu_supports("ssse3"))
+		i = bswap32_array_ssse3(dst, s, count);
+#endif
+	for (; i < count; i++) {
+		memcpy(&val, s + 4 * i, sizeof(val));
+		dst[i] = bswap_32(val);
+	}
+#else
+	memcpy(dst, s, count * sizeof(*dst));
+#endif
+}
@@ -0,0 +1,407 @@
+/*
+ * dollayout.c
+ *
+ * Rewrites a .dol so that the apploader reads it sequentially.
+ * This program is part of the cubeboot-tools package.
+ *
+ * Copyright (C) 2005-2006 The GameCube Linux Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+/*
+ * The apploader loads DOL sections in ascending address order, reading
+ * a section along with the ones before it when it is stored just as far
+ * from them in the file as it is in memory (see dol_sect_follows()).
+ * Here the sections get stored in that same order. Those that can be
+ * read along with the previous ones are stored that way, and any other
+ * one starts on a disc sector boundary, so the drive never seeks
+ * backwards nor reads partial sectors, and issues as few reads as it can.
+ *
+ * The resulting .dol is checked against the same rules the apploader
+ * applies in al_check_dol().
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "../include/lib.h"
+
+#include "../include/dol.h"
+#include "../include/gcm.h"
+
+#define _GNU_SOURCE
+#include <getopt.h>
+
+#define DOLLAYOUT_VERSION "V0.1-20261018"
+
+const char *__progname;
+
+#define DI_ALIGN_SHIFT	5
+#define DI_ALIGN_SIZE	(1UL << DI_ALIGN_SHIFT)
+#define DI_ALIGN_MASK	(~((1 << DI_ALIGN_SHIFT) - 1))
+
+#define di_align(addr)	((((unsigned long)(addr)) + \
+				 DI_ALIGN_SIZE - 1) & DI_ALIGN_MASK)
+
+/**
+ * Gets the sections of a DOL in the order the apploader loads them.
+ * Returns the number of sections found.
+ */
+unsigned int load_order(struct dol_header *dol, int *order)
+{
+	unsigned int sects_bitmap;
+	unsigned long lowest_start;
+	unsigned int nr_sects = 0;
+	int j, k;
+
+	sects_bitmap = (1 << DOL_MAX_SECT) - 1;
+	while (sects_bitmap) {
+		lowest_start = 0xffffffff;
+		for (j = -1, k = 0; k < DOL_MAX_SECT; k++) {
+			/* continue if section is already done */
+			if ((sects_bitmap & (1 << k)) == 0)
+				continue;
+
+			/* mark section as done if empty */
+			if (be32_to_cpu(dol_sect_size(dol, k)) == 0) {
+				sects_bitmap &= ~(1 << k);
+				continue;
+			}
+
+			/* found new candidate */
+			if (be32_to_cpu(dol_sect_address(dol, k)) < lowest_start) {
+				lowest_start = be32_to_cpu(dol_sect_address(dol, k));
+				j = k;
+			}
+		}
+		if (j < 0)
+			break;
+
+		sects_bitmap &= ~(1 << j);
+		order[nr_sects++] = j;
+	}
+	return nr_sects;
+}
+
+/**
+ * Applies the apploader al_check_dol() rules to a DOL.
+ * Returns the number of problems found, reporting each one.
+ */
+int check_dol(struct dol_header *dol, unsigned long dol_length,
+	      const char *name)
+{
+	uint32_t offset, address, size, entry_point, address_bss;
+	int i, valid = 0, problems = 0;
+
+#define report(fmt, args...) \
+	do { \
+		fprintf(stderr, "%s: " fmt, name, ## args); \
+		problems++; \
+	} while (0)
+
+	entry_point = be32_to_cpu(dol->entry_point);
+	for (i = 0; i < DOL_MAX_SECT; i++) {
+		offset = be32_to_cpu(dol_sect_offset(dol, i));
+		address = be32_to_cpu(dol_sect_address(dol, i));
+		size = be32_to_cpu(dol_sect_size(dol, i));
+
+		if (offset != 0 && offset < DOL_HEADER_SIZE)
+			report("section %d offset within DOL header\n", i);
+		if (offset != di_align(offset))
+			report("section %d offset unaligned\n", i);
+		if (address != di_align(address))
+			report("section %d address unaligned\n", i);
+		if ((unsigned long)offset + size > dol_length)
+			report("section %d past DOL file size\n", i);
+
+		if (address != 0) {
+			if (!(address & 0x80000000))
+				report("section %d below 2GB\n", i);
+			if (address > 0x81200000)
+				report("section %d above 0x81200000\n", i);
+		}
+
+		if (i < DOL_SECT_MAX_TEXT && entry_point >= address &&
+		    entry_point < address + size)
+			valid = 1;
+	}
+
+	address_bss = be32_to_cpu(dol->address_bss);
+	if (address_bss != 0 && !(address_bss & 0x80000000))
+		report("BSS segment below 2GB\n");
+
+	if (!valid)
+		report("entry point out of text segment\n");
+
+#undef report
+
+	return problems;
+}
+
+/**
+ * Checks that sections are stored in load order, each one either on a
+ * sector boundary or where the apploader reads it along with the ones
+ * before it.
+ * Returns the number of problems found, reporting each one.
+ */
+int check_layout(struct dol_header *dol, unsigned long align,
+		 const char *name)
+{
+	int order[DOL_MAX_SECT];
+	unsigned int nr_sects, i;
+	uint32_t offset, address, size, last_end = 0;
+	unsigned long end = 0, disk_end = 0;
+	int problems = 0;
+
+	nr_sects = load_order(dol, order);
+	for (i = 0; i < nr_sects; i++) {
+		offset = be32_to_cpu(dol_sect_offset(dol, order[i]));
+		address = be32_to_cpu(dol_sect_address(dol, order[i]));
+		size = be32_to_cpu(dol_sect_size(dol, order[i]));
+		if (offset % align &&
+		    (i == 0 ||
+		     !dol_sect_follows(address, offset, end, disk_end,
+				       be32_to_cpu(dol->address_bss),
+				       be32_to_cpu(dol->size_bss)))) {
+			fprintf(stderr, "%s: section %d neither on a %lu byte"
+				" boundary nor read along with section %d\n",
+				name, order[i], align, i ? order[i-1] : -1);
+			problems++;
+		}
+		if (offset < last_end) {
+			fprintf(stderr, "%s: section %d stored out of load"
+				" order\n", name, order[i]);
+			problems++;
+		}
+		last_end = offset + size;
+		end = address + di_align(size);
+		disk_end = offset + di_align(size);
+	}
+	return problems;
+}
+
+/**
+ * Works out where each section goes in the new DOL, in load order.
+ * A section that the apploader can read along with the ones before it
+ * is stored right after them, as far from them as it is in memory.
+ * Any other section starts a new run, on an @align boundary.
+ * Returns the size of the new DOL.
+ */
+unsigned long plan_layout(struct dol_header *dol, int *order,
+			  unsigned int nr_sects, unsigned long align,
+			  unsigned long *offsets)
+{
+	unsigned long end = 0, disk_end = align, offset;
+	uint32_t address, length;
+	unsigned int i;
+
+	for (i = 0; i < nr_sects; i++) {
+		address = be32_to_cpu(dol_sect_address(dol, order[i]));
+		length = be32_to_cpu(dol_sect_size(dol, order[i]));
+
+		offset = disk_end + (address - end);
+		if (i == 0 ||
+		    !dol_sect_follows(address, offset, end, disk_end,
+				      be32_to_cpu(dol->address_bss),
+				      be32_to_cpu(dol->size_bss)))
+			offset = (disk_end + align - 1) / align * align;
+		offsets[i] = offset;
+
+		/* the apploader always reads whole 32 byte blocks */
+		end = address + di_align(length);
+		disk_end = offset + di_align(length);
+	}
+	return disk_end;
+}
+
+/**
+ * Builds the new DOL, returning its size.
+ */
+unsigned long relayout_dol(uint8_t **out, uint8_t *in, unsigned long align)
+{
+	struct dol_header *dol = (struct dol_header *)in;
+	struct dol_header *new_dol;
+	int order[DOL_MAX_SECT];
+	unsigned long offsets[DOL_MAX_SECT];
+	unsigned int nr_sects, i;
+	unsigned long size;
+	uint32_t length;
+	int k;
+
+	nr_sects = load_order(dol, order);
+	size = plan_layout(dol, order, nr_sects, align, offsets);
+
+	*out = xmalloc(size);
+	memset(*out, 0, size);
+	new_dol = (struct dol_header *)*out;
+	memcpy(new_dol, dol, sizeof(*new_dol));
+
+	/* sections not in use keep no offset */
+	memset(new_dol->offset_text, 0, sizeof(new_dol->offset_text));
+	memset(new_dol->offset_data, 0, sizeof(new_dol->offset_data));
+
+	for (i = 0; i < nr_sects; i++) {
+		k = order[i];
+		length = be32_to_cpu(dol_sect_size(dol, k));
+
+		memcpy(*out + offsets[i],
+		       in + be32_to_cpu(dol_sect_offset(dol, k)), length);
+		if (k < DOL_SECT_MAX_TEXT)
+			new_dol->offset_text[k] = cpu_to_be32(offsets[i]);
+		else
+			new_dol->offset_data[k - DOL_SECT_MAX_TEXT] =
+						cpu_to_be32(offsets[i]);
+	}
+
+	return size;
+}
+
+/**
+ *
+ */
+void version(void)
+{
+	printf("version %s\n", DOLLAYOUT_VERSION);
+	exit(2);
+}
+
+/**
+ *
+ */
+void usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [OPTION] [FILE] -o [OUTFILE]" "\n"
+		"  -a, --align=SIZE        section alignment in the file"
+					" (default %d)" "\n"
+		"  -c, --check             only check the layout of FILE" "\n"
+		"  -o, --outfile=PATH      output file (default stdout)" "\n"
+		, __progname, DI_SECTOR_SIZE);
+	exit(1);
+}
+
+/**
+ *
+ */
+int main(int argc, char *argv[])
+{
+	char *outfile = NULL, *infile = NULL;
+	unsigned long align = DI_SECTOR_SIZE;
+	unsigned long out_size, progress;
+	struct dol_header *dol;
+	uint8_t *in, *out;
+	off_t in_size;
+	int check_only = 0;
+	int fout, problems;
+	ssize_t result;
+	char *p;
+	int ch, k;
+	uint32_t offset, size;
+
+	struct option long_options[] = {
+		{"align", 1, NULL, 'a'},
+		{"check", 0, NULL, 'c'},
+		{"outfile", 1, NULL, 'o'},
+		{"version", 0, NULL, 'v'},
+		{"help", 0, NULL, 'h'},
+		{0,0,0,0}
+	};
+#define SHORT_OPTIONS "a:co:vh"
+
+	p = strrchr(argv[0], '/');
+	__progname = (p && p[1]) ? p+1 : argv[0];
+
+	while((ch = getopt_long(argc, argv, SHORT_OPTIONS,
+				long_options, NULL)) != -1) {
+		switch(ch) {
+			case 'a':
+				align = strtoul(optarg, &p, 0);
+				if (*p || align < DI_ALIGN_SIZE ||
+				    align % DI_ALIGN_SIZE)
+					die("alignment must be a multiple"
+					    " of %lu\n", DI_ALIGN_SIZE);
+				break;
+			case 'c':
+				check_only = 1;
+				break;
+			case 'o':
+				outfile = optarg;
+				break;
+			case 'v':
+				version();
+				break;
+			case 'h':
+			case '?':
+			default:
+				usage();
+				break;
+		}
+	}
+
+	if (argc-optind != 1)
+		usage();
+	infile = argv[optind];
+
+	in = (uint8_t *)slurp_file(infile, &in_size);
+	if (in_size < (off_t)sizeof(*dol))
+		die("%s: can't read dol header: input too short\n", infile);
+	dol = (struct dol_header *)in;
+
+	/* sections must be fully contained in the input */
+	for (k = 0; k < DOL_MAX_SECT; k++) {
+		offset = be32_to_cpu(dol_sect_offset(dol, k));
+		size = be32_to_cpu(dol_sect_size(dol, k));
+		if (size && (offset > in_size || size > in_size - offset))
+			die("%s: section %d is past the end of the input\n",
+			    infile, k);
+	}
+
+	if (check_only) {
+		problems = check_dol(dol, in_size, infile) +
+			   check_layout(dol, align, infile);
+		return problems ? 1 : 0;
+	}
+
+	out_size = relayout_dol(&out, in, align);
+	if (check_dol((struct dol_header *)out, out_size, infile))
+		die("%s: the apploader would reject this DOL\n", infile);
+
+	if (!outfile || !strcmp(outfile, "-")) {
+		outfile = "*stdout*";
+		fout = STDOUT_FILENO;
+	} else {
+		fout = open(outfile, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		if (fout < 0) {
+			die("%s: can't open output file: %s\n",
+				outfile, strerror(errno));
+		}
+	}
+
+	for (progress = 0; progress < out_size; progress += result) {
+		result = write(fout, out + progress, out_size - progress);
+		if (result < 0) {
+			if ((errno == EINTR) || (errno == EAGAIN)) {
+				result = 0;
+				continue;
+			}
+			die("%s: can't write output: %s\n", outfile,
+			    strerror(errno));
+		}
+	}
+
+	close(fout);
+	free(out);
+	free(in);
+
+	return 0;
+}
@@ -0,0 +1,217 @@
+/*
+ * dolreltime.c
+ *
+ * Decodes the boot stage timestamps left by the relocation stub.
+ * This program is part of the cubeboot-tools package.
+ *
+ * Copyright (C) 2005-2006 The GameCube Linux Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+/*
+ * The stub stamps the end of each boot stage with the lower timebase word
+ * into a struct dolrel_timing at DOLREL_TIMING_ADDRESS. Given a dump of
+ * main memory (or of just that area), this prints how long each stage took.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/lib.h"
+
+#include "../include/dolrel.h"
+
+#define _GNU_SOURCE
+#include <getopt.h>
+
+#define DOLRELTIME_VERSION "V0.1-20261018"
+
+const char *__progname;
+
+/* the timebase runs at a quarter of the 162MHz bus clock */
+#define TB_TICKS_PER_USEC	40.5
+
+/* and the 486MHz core at three times the bus clock */
+#define CORE_CYCLES_PER_TICK	12
+
+#define MB			(1024 * 1024)
+
+static const char *stage_names[DOLREL_NR_STAMPS] = {
+	[DOLREL_STAMP_ENTRY]	= "stub entry",
+	[DOLREL_STAMP_QUIESCE]	= "di quiesce",
+	[DOLREL_STAMP_MOTOR]	= "motor stop",
+	[DOLREL_STAMP_RELOCATE]	= "relocation",
+	[DOLREL_STAMP_BSS]	= "bss clear",
+	[DOLREL_STAMP_DRIVE]	= "drive wait",
+};
+
+/**
+ * Prints a stage that ended at stamp, and started at previous.
+ */
+void print_stage(const char *name, int index, uint32_t start,
+		 uint32_t previous, uint32_t stamp)
+{
+	char label[32];
+
+	if (index >= 0)
+		snprintf(label, sizeof(label), "%s %d", name, index);
+	else
+		snprintf(label, sizeof(label), "%s", name);
+
+	/* timebase differences survive a wrap of the lower word */
+	printf("%-20s %12.1f %12.1f\n", label,
+	       (uint32_t)(stamp - start) / TB_TICKS_PER_USEC,
+	       (uint32_t)(stamp - previous) / TB_TICKS_PER_USEC);
+}
+
+/**
+ * Prints how fast the relocation stage went, in time and core cycles
+ * per MB written, so copy routines can be compared on hardware.
+ */
+void print_throughput(uint32_t bytes, uint32_t start, uint32_t stamp)
+{
+	double ticks_per_mb;
+
+	if (!bytes)
+		return;
+
+	ticks_per_mb = (double)(uint32_t)(stamp - start) * MB / bytes;
+	printf("%-20s %u bytes, %.1f us/MB, %.0f cycles/MB\n", "relocated",
+	       bytes, ticks_per_mb / TB_TICKS_PER_USEC,
+	       ticks_per_mb * CORE_CYCLES_PER_TICK);
+}
+
+/**
+ *
+ */
+void decode_timing(struct dolrel_timing *timing)
+{
+	uint32_t stamps[DOLREL_NR_STAMPS];
+	uint32_t start, previous, stamp;
+	uint32_t nr_sections, timed, i;
+	int k;
+
+	be32_to_cpu_array(stamps, timing->stamps, DOLREL_NR_STAMPS);
+	nr_sections = be32_to_cpu(timing->nr_sections);
+	timed = nr_sections;
+	if (timed > DOLREL_TIMING_SECTIONS)
+		timed = DOLREL_TIMING_SECTIONS;
+
+	printf("%-20s %12s %12s\n", "stage", "end (us)", "took (us)");
+
+	start = previous = stamps[DOLREL_STAMP_ENTRY];
+	for (k = 0; k < DOLREL_NR_STAMPS; k++) {
+		/* relocation entries are timed within the relocation stage */
+		if (k == DOLREL_STAMP_RELOCATE) {
+			for (i = 0; i < timed; i++) {
+				stamp = be32_to_cpu(timing->section_stamps[i]);
+				print_stage("section", i, start, previous,
+					    stamp);
+				previous = stamp;
+			}
+			if (timed < nr_sections)
+				printf("(%u more sections not timed)\n",
+				       nr_sections - timed);
+		}
+		print_stage(stage_names[k], -1, start, previous, stamps[k]);
+		previous = stamps[k];
+	}
+
+	print_throughput(be32_to_cpu(timing->nr_bytes),
+			 stamps[DOLREL_STAMP_MOTOR],
+			 stamps[DOLREL_STAMP_RELOCATE]);
+}
+
+/**
+ *
+ */
+void version(void)
+{
+	printf("version %s\n", DOLRELTIME_VERSION);
+	exit(2);
+}
+
+/**
+ *
+ */
+void usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [OPTION] [FILE]" "\n"
+		"  -a, --address=ADDR      memory address of the first byte"
+					" of FILE" "\n"
+		"                          (default 0x%08x)" "\n"
+		, __progname, 0x80000000);
+	exit(1);
+}
+
+/**
+ *
+ */
+int main(int argc, char *argv[])
+{
+	unsigned long address = 0x80000000;
+	struct dolrel_timing *timing;
+	char *infile, *p;
+	off_t in_size;
+	uint8_t *in;
+	int ch;
+
+	struct option long_options[] = {
+		{"address", 1, NULL, 'a'},
+		{"version", 0, NULL, 'v'},
+		{"help", 0, NULL, 'h'},
+		{0,0,0,0}
+	};
+#define SHORT_OPTIONS "a:vh"
+
+	p = strrchr(argv[0], '/');
+	__progname = (p && p[1]) ? p+1 : argv[0];
+
+	while((ch = getopt_long(argc, argv, SHORT_OPTIONS,
+				long_options, NULL)) != -1) {
+		switch(ch) {
+			case 'a':
+				address = strtoul(optarg, &p, 0);
+				if (*p)
+					die("bad address %s\n", optarg);
+				/* physical addresses work too */
+				address = 0x80000000 | (address & 0x1fffffff);
+				break;
+			case 'v':
+				version();
+				break;
+			case 'h':
+			case '?':
+			default:
+				usage();
+				break;
+		}
+	}
+
+	if (argc-optind != 1)
+		usage();
+	infile = argv[optind];
+
+	in = (uint8_t *)slurp_file(infile, &in_size);
+	if (address > DOLREL_TIMING_ADDRESS ||
+	    in_size < (off_t)(DOLREL_TIMING_ADDRESS - address +
+			      sizeof(*timing)))
+		die("%s: dump doesn't cover the timing records at 0x%08x\n",
+		    infile, DOLREL_TIMING_ADDRESS);
+	timing = (struct dolrel_timing *)(in + DOLREL_TIMING_ADDRESS - address);
+
+	if (be32_to_cpu(timing->magic) != DOLREL_TIMING_MAGIC)
+		die("%s: no timing records found\n", infile);
+
+	decode_timing(timing);
+
+	return 0;
+}
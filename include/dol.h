@@ -55,5 +55,45 @@ struct dol_header {
 	uint8_t __pad[0x1c];
 } __attribute__ ((__packed__));
 
+/*
+ * Section runs read by the apploader in a single request
+ */
+
+/* largest hole between two sections of a run, one disc sector */
+#define DOL_SECT_GAP_MAX	2048
+
+/* what the IPL leaves for the OS in low memory */
+#define DOL_LOWMEM_END		0x80003100
+
+/*
+ * Checks if a section at @address in memory and @offset in the file can
+ * be read in the same request as the sections ending at @end in memory
+ * and at @disk_end in the file. All values are in host byte order.
+ *
+ * The section must be just as far from the end of the request on disc
+ * as it is in memory, so the bytes in between land where they belong.
+ * Those bytes are not part of any section, so they must not hit
+ * anything that the IPL or the .bss are using.
+ */
+static inline int dol_sect_follows(uint32_t address, uint32_t offset,
+				   unsigned long end, unsigned long disk_end,
+				   uint32_t address_bss, uint32_t size_bss)
+{
+	unsigned long gap = address - end;
+
+	if (address < end || gap > DOL_SECT_GAP_MAX)
+		return 0;
+	if (offset < disk_end || offset - disk_end != gap)
+		return 0;
+
+	if (gap == 0)
+		return 1;
+	if (end < DOL_LOWMEM_END)
+		return 0;
+	if (size_bss && end < address_bss + size_bss && address > address_bss)
+		return 0;
+	return 1;
+}
+
 #endif /* __DOL_H */
 
@@ -18,22 +18,117 @@
 #include <sys/types.h>
 #include <stdint.h>
 
+#define DOLREL_VERSION		0xdead0009
+
 #define DOLREL_FLAG_STOP_MOTOR     (1<<0)
 #define DOLREL_FLAG_DISABLE_XENOGC (1<<1)
+#define DOLREL_FLAG_LC_DMA	   (1<<2)	/* copy through the locked cache */
+#define DOLREL_FLAG_LZ		   (1<<3)	/* some entries are compressed */
+#define DOLREL_FLAG_ALL		   (DOLREL_FLAG_STOP_MOTOR | \
+				    DOLREL_FLAG_DISABLE_XENOGC | \
+				    DOLREL_FLAG_LC_DMA | \
+				    DOLREL_FLAG_LZ)
+
+/*
+ * Run flags a stub is built to handle.
+ * The stub advertises them in the flags of its control header template,
+ * udolrel then replaces those with the flags requested.
+ */
+#ifndef SDRE_FLAGS
+#define SDRE_FLAGS		DOLREL_FLAG_ALL
+#endif
+
+/* relocation entry flags */
+#define DOLREL_SECT_BACKWARD	(1<<0)	/* dst overlaps src from above */
+#define DOLREL_SECT_SCRATCH	(1<<1)	/* staged move, no cache sync needed */
+#define DOLREL_SECT_LZ		(1<<2)	/* src holds an LZ4 block */
+#define DOLREL_SECT_FILL	(1<<3)	/* no src, clear dst to zero */
+
+/* where the stub is loaded, and where crt0.S sets up its stack */
+#define DOLREL_STUB_ADDRESS	0x80003100
+#define DOLREL_STACK_TOP	0x81600000
+#define DOLREL_STACK_SIZE	0x4000
+#define DOLREL_MEM_END		0x81800000
+
+/* the apploader runs from here, the loader can't place sections above */
+#define DOLREL_LOAD_LIMIT	0x81200000
+
+/* extra payloads (like an initrd) placed along with the image */
+#define DOLREL_MAX_BLOBS	4
+
+/* waits measured by the stub, in timebase ticks */
+#define DOLREL_WAIT_DI_RESET	0	/* until the drive takes commands */
+#define DOLREL_WAIT_DI_COMMAND	1	/* longest DI command */
+#define DOLREL_WAIT_XENOGC	2	/* until the drivechip is done */
+#define DOLREL_NR_WAITS		3
+
+/*
+ * Boot stage timestamps, left by the stub at the bottom of its stack
+ * window, far below anything the stub pushes. udolrel keeps sections,
+ * bss and blobs out of that window, so they survive until the kernel
+ * (or a RAM dump) picks them up, and the OS globals in low memory are
+ * left alone.
+ */
+#define DOLREL_TIMING_ADDRESS	(DOLREL_STACK_TOP - DOLREL_STACK_SIZE)
+#define DOLREL_TIMING_MAGIC	0x54494d45	/* "TIME" */
+
+/* when each stage ended, the first stamp is taken on stub entry */
+#define DOLREL_STAMP_ENTRY	0	/* stub entered */
+#define DOLREL_STAMP_QUIESCE	1	/* DI interrupts quiesced */
+#define DOLREL_STAMP_MOTOR	2	/* motor stop issued */
+#define DOLREL_STAMP_RELOCATE	3	/* all sections relocated */
+#define DOLREL_STAMP_BSS	4	/* bss cleared */
+#define DOLREL_STAMP_DRIVE	5	/* drive done, about to jump */
+#define DOLREL_NR_STAMPS	6
+
+/* relocation entries timed individually, the rest only count */
+#define DOLREL_TIMING_SECTIONS	48
+
+/*
+ * These structures are shared between the host tools and the relocation
+ * stub, so they only use fixed width types. All fields are big endian.
+ */
 
 struct dolrel_section {
-	void	*dst_address;
-	size_t	length;
+	uint32_t	flags;
+	uint32_t	src_address;
+	uint32_t	src_length;	/* bytes in the payload */
+	uint32_t	dst_address;
+	uint32_t	length;		/* bytes at the destination */
+};
+
+struct dolrel_blob {
+	uint32_t	address;
+	uint32_t	size;
 };
 
+/*
+ * The stub hands a pointer to this over to the entry point in r3.
+ */
 struct dolrel_control {
 	uint32_t	version;
-	unsigned long	flags;
-	void		*entry_point;
-	void		*address_bss;
+	uint32_t	flags;
+	uint32_t	entry_point;
+	uint32_t	address_bss;
 	uint32_t	size_bss;
-	void		*src_address;
+	uint32_t	src_address;
 	uint32_t	nr_sections;
+	uint32_t	nr_blobs;
+	struct dolrel_blob blobs[DOLREL_MAX_BLOBS];
+	uint32_t	xenogc_grace_msecs;	/* before polling the drivechip */
+	uint32_t	wait_ticks[DOLREL_NR_WAITS];
+};
+
+/*
+ * Found at DOLREL_TIMING_ADDRESS. Stamps are the lower timebase word.
+ * Must stay well within DOLREL_STACK_SIZE.
+ */
+struct dolrel_timing {
+	uint32_t	magic;
+	uint32_t	nr_sections;	/* relocation entries processed */
+	uint32_t	nr_bytes;	/* bytes they wrote */
+	uint32_t	stamps[DOLREL_NR_STAMPS];
+	uint32_t	section_stamps[DOLREL_TIMING_SECTIONS];
 };
 
 extern struct dolrel_control __dolrel_control;
@@ -28,10 +28,17 @@ struct gcm_disk_info {
 	char version;
 	char audio_streaming;
 	char stream_buffer_size;
-	char unused_1[18];
+	uint8_t boot_flags;	/* GCM_BOOT_xxx, for our apploader */
+	char unused_1[17];
 	uint32_t magic;	/* 0xc2339f3d */
 } __attribute__ ((__packed__));
 
+/* the payload uses neither fst.bin nor bi2.bin */
+#define GCM_BOOT_NO_FST		(1<<0)
+
+/* found in apploaders which honour GCM_BOOT_NO_FST */
+#define GCM_AL_TAG_NO_FST	"cubeboot-al:no-fst"
+
 struct gcm_disk_layout {
 	uint32_t dol_offset;
 	uint32_t fst_offset;
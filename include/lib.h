@@ -16,6 +16,7 @@
 #define __LIB_H
 
 #include <sys/types.h>
+#include <stdint.h>
 
 #include <endian.h>
 #include <byteswap.h>
@@ -39,5 +40,7 @@ void *xrealloc(void *ptr, size_t size);
 int pad_file(int fd, int size);
 char *slurp_file(const char *filename, off_t * r_size);
 
+void be32_to_cpu_array(uint32_t *dst, const void *src, size_t count);
+
 #endif /* __LIB_H */
 
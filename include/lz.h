@@ -0,0 +1,23 @@
+/*
+ * lz.h
+ *
+ * LZ4 block format compressor.
+ * Copyright (C) 2005-2006 The GameCube Linux Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+#ifndef __LZ_H
+#define __LZ_H
+
+#include <sys/types.h>
+#include <stdint.h>
+
+size_t lz_compress(uint8_t *dst, size_t dst_size,
+		   const uint8_t *src, size_t src_size);
+
+#endif /* __LZ_H */
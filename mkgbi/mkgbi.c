@@ -35,6 +35,7 @@ const char *__progname;
 
 char *apploader_bin;
 char *opening_bnr;
+int no_fst;
 
 #define DEFAULT_OPENING_BNR GCM_OPENING_BNR
 #define DEFAULT_APPLOADER_BIN "apploader.bin"
@@ -273,11 +274,28 @@ void usage(void)
 		"      (default `apploader.bin')" "\n"
 		"  -b, --banner=FILE       use banner from file" "\n"
 		"      (default `openning.bnr')" "\n"
+		"  -n, --no-fst            tell the apploader not to load"
+		" fst.bin and bi2.bin" "\n"
 		"  -o, --outfile=PATH      output file (default stdout)" "\n",
 		__progname);
 	exit(1);
 }
 
+/*
+ * Tells if the apploader image carries the given tag.
+ */
+static int apploader_has_tag(const void *image, size_t size, const char *tag)
+{
+	const char *p = image;
+	size_t len = strlen(tag);
+
+	for (; size >= len; p++, size--) {
+		if (!memcmp(p, tag, len))
+			return 1;
+	}
+	return 0;
+}
+
 /*
  *
  */
@@ -314,12 +332,13 @@ int main(int argc, char *argv[])
 	struct option long_options[] = {
 		{"apploader", 1, NULL, 'a'},
 		{"banner", 1, NULL, 'b'},
+		{"no-fst", 0, NULL, 'n'},
 		{"outfile", 1, NULL, 'o'},
 		{"version", 0, NULL, 'v'},
 		{"help", 0, NULL, 'h'},
 		{0, 0, 0, 0}
 	};
-#define SHORT_OPTIONS "a:b:o:vh"
+#define SHORT_OPTIONS "a:b:no:vh"
 
 	p = strrchr(argv[0], '/');
 	__progname = (p && p[1]) ? p + 1 : argv[0];
@@ -337,6 +356,9 @@ int main(int argc, char *argv[])
 			if (set_banner(optarg) < 0)
 				usage();
 			break;
+		case 'n':
+			no_fst = 1;
+			break;
 		case 'o':
 			outfile = optarg;
 			break;
@@ -368,6 +390,15 @@ int main(int argc, char *argv[])
 	sa.fst_image = fst;
 	sa.fst_size = fst_size;
 
+	if (no_fst) {
+		/* an older apploader would ignore the flag, and fail to boot */
+		if (!apploader_has_tag(sa.al_image, sa.al_size,
+				       GCM_AL_TAG_NO_FST))
+			die("%s doesn't support --no-fst,"
+			    " rebuild it from ppc/apploader\n", apploader_bin);
+		sa.dh.info.boot_flags |= GCM_BOOT_NO_FST;
+	}
+
 	if (sizeof(sa.dh) + 0x2000 + sizeof(sa.al_header) +
 	    di_align_size(sa.al_size) + di_align_size(sa.fst_size) +
 	    di_align_size(sa.bnr_size) > SYSTEM_AREA_SIZE) {
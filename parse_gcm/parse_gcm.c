@@ -17,6 +17,8 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/stat.h>
@@ -32,6 +34,74 @@ struct gcm_apploader_header appldr_bin;
 #define BUF_SIZE 4096
 static char buf[BUF_SIZE];
 
+/*
+ * Forward-only input stream.
+ * Lets us parse images from pipes, where seeking is not possible.
+ */
+struct gcm_stream {
+	int fd;
+	int seekable;
+	off_t pos;
+};
+
+static void stream_init(struct gcm_stream *s, int fd)
+{
+	s->fd = fd;
+	s->pos = lseek(fd, 0, SEEK_CUR);
+	s->seekable = (s->pos != (off_t)-1);
+	if (!s->seekable)
+		s->pos = 0;
+}
+
+/*
+ * Reads exactly len bytes, coping with short reads.
+ */
+static void stream_read(struct gcm_stream *s, void *data, size_t len,
+			const char *what)
+{
+	size_t progress = 0;
+	ssize_t result;
+
+	while (progress < len) {
+		result = read(s->fd, (char *)data + progress, len - progress);
+		if (result < 0) {
+			if ((errno == EINTR) || (errno == EAGAIN))
+				continue;
+			die("can't read %s: %s\n", what, strerror(errno));
+		}
+		if (result == 0)
+			die("unexpected end of input reading %s\n", what);
+		progress += result;
+	}
+	s->pos += len;
+}
+
+/*
+ * Advances the stream up to offset, discarding data if we can't seek.
+ */
+static void stream_skip_to(struct gcm_stream *s, off_t offset,
+			   const char *what)
+{
+	size_t chunk;
+
+	if (offset < s->pos)
+		die("%s at 0x%08lx is behind current position 0x%08lx\n",
+		    what, offset + 0UL, s->pos + 0UL);
+
+	if (s->seekable) {
+		if (lseek(s->fd, offset, SEEK_SET) == (off_t)-1)
+			die("can't seek to %s position: %s\n",
+			    what, strerror(errno));
+		s->pos = offset;
+		return;
+	}
+
+	while (s->pos < offset) {
+		chunk = (offset - s->pos > BUF_SIZE) ? BUF_SIZE : offset - s->pos;
+		stream_read(s, buf, chunk, what);
+	}
+}
+
 #define copy_to_null_terminated_buffer(dstbuf, srcbuf) \
 	{ memcpy(dstbuf, srcbuf, sizeof(srcbuf)); \
 	  dstbuf[sizeof(srcbuf)] = 0; }
@@ -49,6 +119,7 @@ void print_disk_header(struct gcm_disk_header *dh)
 	printf("version = %x\n", dh->info.version);
 	printf("audio_streaming = %x\n", dh->info.audio_streaming);
 	printf("stream_buffer_size = %x\n", dh->info.stream_buffer_size);
+	printf("boot_flags = %x\n", dh->info.boot_flags);
 	printf("magic = %x (%s)\n", be32_to_cpu(dh->info.magic),
 	       (be32_to_cpu(dh->info.magic) == GCM_MAGIC)?"OK":"wrong!");
 	
@@ -105,16 +176,69 @@ static void print_apploader_header(struct gcm_apploader_header *ah)
 	printf("unknown_1 = 0x%08x (%1$d)\n", be32_to_cpu(ah->unknown_1));
 }
 
+/*
+ * Decoded FST, in cpu byte order, with one array per entry field.
+ * For directories, offset holds parent_directory_offset and
+ * length holds this_directory_offset.
+ */
+struct fst_table {
+	unsigned int nr_entries;
+	uint8_t *flags;
+	uint32_t *fname_offset;
+	uint32_t *offset;
+	uint32_t *length;
+	char *string_table;
+};
+
+/*
+ * Byte-swaps the whole entry table in one go and splits it into fields.
+ */
+static void decode_fst(struct fst_table *t, void *fst, unsigned long fst_size)
+{
+	const unsigned int words_per_entry =
+		sizeof(struct gcm_file_entry) / sizeof(uint32_t);
+	uint32_t *words, *w;
+	unsigned int i, nr_entries;
+
+	if (fst_size < sizeof(struct gcm_file_entry))
+		die("fst too small (%lu bytes)\n", fst_size);
+
+	nr_entries = be32_to_cpu(((struct gcm_file_entry *)fst)->root_dir.num_entries);
+	if (nr_entries == 0 ||
+	    nr_entries > fst_size / sizeof(struct gcm_file_entry))
+		die("fst claims %u entries, but only has %lu bytes\n",
+		    nr_entries, fst_size);
+
+	words = xmalloc(nr_entries * sizeof(struct gcm_file_entry));
+	be32_to_cpu_array(words, fst, nr_entries * words_per_entry);
+
+	t->nr_entries = nr_entries;
+	t->flags = xmalloc(nr_entries * sizeof(*t->flags));
+	t->fname_offset = xmalloc(nr_entries * sizeof(*t->fname_offset));
+	t->offset = xmalloc(nr_entries * sizeof(*t->offset));
+	t->length = xmalloc(nr_entries * sizeof(*t->length));
+	t->string_table = (char *)fst + nr_entries * sizeof(struct gcm_file_entry);
+
+	for (i = 0, w = words; i < nr_entries; i++, w += words_per_entry) {
+		t->flags[i] = w[0] >> 24;
+		t->fname_offset[i] = w[0] & 0x00ffffff;
+		t->offset[i] = w[1];
+		t->length[i] = w[2];
+	}
+
+	free(words);
+}
+
 #if 0
-int dump_file(int fd, struct gcm_file_entry *fe, char *fname)
+int dump_file(int fd, struct fst_table *t, unsigned int index, char *fname)
 {
 	int outfd;
 	off_t saved_pos, pos;
 	unsigned long file_offset, file_length, chunk_size;
 	int result;
 
-	file_offset = be32_to_cpu(fe->file.file_offset);
-	file_length = be32_to_cpu(fe->file.file_length);
+	file_offset = t->offset[index];
+	file_length = t->length[index];
 
 	outfd = open(fname, O_CREAT|O_WRONLY);
 	if (outfd < 0)
@@ -147,65 +271,39 @@ int dump_file(int fd, struct gcm_file_entry *fe, char *fname)
 }
 #endif
 
-void print_file_entry(int fd, struct gcm_file_entry *fe, void *fst, char *string_table)
+void print_file_entry(struct fst_table *t, unsigned int index)
 {
-	unsigned long fname_offset;
-	char *fname;
-
 	printf("-- file entry --\n");
 
-	printf("type = %s\n", (fe->flags)?"directory":"file");
-	fname_offset = be32_to_cpu(fe->file.fname_offset) & 0x00ffffff;
-	printf("fname_offset = 0x%08x\n", fname_offset);
-	printf("fname = %s\n", fname = string_table + fname_offset);
+	printf("type = %s\n", (t->flags[index])?"directory":"file");
+	printf("fname_offset = 0x%08x\n", t->fname_offset[index]);
+	printf("fname = %s\n", t->string_table + t->fname_offset[index]);
 
-	if (fe->flags) {
+	if (t->flags[index]) {
 		printf("parent_directory_offset = 0x%08x\n",
-			be32_to_cpu(fe->dir.parent_directory_offset));
+			t->offset[index]);
 		printf("this_directory_offset = 0x%08x\n",
-			be32_to_cpu(fe->dir.this_directory_offset));
+			t->length[index]);
 	} else {
-		printf("file_offset = 0x%08x\n",
-			be32_to_cpu(fe->file.file_offset));
-		printf("file_length = 0x%08x (%1$d)\n",
-			be32_to_cpu(fe->file.file_length));
+		printf("file_offset = 0x%08x\n", t->offset[index]);
+		printf("file_length = 0x%08x (%1$d)\n", t->length[index]);
 	}
 }
 
-int parse_directory(int fd, struct gcm_file_entry *fe, struct gcm_file_entry *parent_fe,
-		    void *fst, char *string_table)
+void parse_directory(struct fst_table *t, unsigned int index)
 {
-	struct gcm_file_entry *next_fe;
-	unsigned long parent_directory_offset;
-	unsigned long directory_offset;
-	unsigned long this_directory_offset;
-
-	this_directory_offset = be32_to_cpu(fe->dir.this_directory_offset);
-	parent_directory_offset = be32_to_cpu(fe->dir.parent_directory_offset);
-
-	if (parent_fe) {
-		directory_offset = (void *)parent_fe - fst;
-		if (directory_offset != parent_directory_offset) {
-			die("bug in parser, claimed parent not parent!\n");
-		}
-	}
-
-	print_file_entry(fd, fe, fst, string_table);
-	printf("this offset = %p\n", (void *)fe - fst);
+	print_file_entry(t, index);
+	printf("this offset = %p\n",
+	       (void *)(index * sizeof(struct gcm_file_entry)));
 }
 
-int parse_fst(int fd, struct gcm_disk_header *dh)
+int parse_fst(struct gcm_stream *s, struct gcm_disk_header *dh)
 {
 	void *fst;
 	unsigned long fst_size;
-	struct gcm_file_entry *fe;
-
-	char *string_table;
+	struct fst_table table;
 	unsigned long string_table_offset;
-
-	int num_entries;
-
-	int result;
+	unsigned int index;
 
 	printf("\n== FST parser ==\n");
 
@@ -214,32 +312,24 @@ int parse_fst(int fd, struct gcm_disk_header *dh)
 	if (!fst)
 		die("can't allocate memory for fst\n");
 
-	result = read(fd, fst, fst_size);
-	if (result < 0)
-		die("can't read fst: %s", strerror(errno));
+	stream_read(s, fst, fst_size, "fst.bin");
 
-	fe = (struct gcm_file_entry *)fst;
+	decode_fst(&table, fst, fst_size);
 
-	num_entries = be32_to_cpu(fe->root_dir.num_entries);
 	string_table_offset = be32_to_cpu(dh->layout.fst_offset) +
-				 num_entries * sizeof(*fe);
-	string_table = fst + num_entries * sizeof(*fe);
+				 table.nr_entries * sizeof(struct gcm_file_entry);
 
 	printf("fst loaded at address %p\n", fst);
-	printf("fst has %d file entries\n", num_entries);
+	printf("fst has %d file entries\n", table.nr_entries);
 
-	printf("string table loaded at address %p\n", string_table);
+	printf("string table loaded at address %p\n", table.string_table);
 	printf("string table located at offset 0x%08x\n", string_table_offset);
 
 	/* skip root directory */
-	fe++;
-	num_entries--;
+	for (index = 1; index < table.nr_entries; index++)
+		parse_directory(&table, index);
 
-	while (num_entries > 0) {
-		parse_directory(fd, fe, NULL, fst, string_table);
-		fe++;
-		num_entries--;
-	}
+	return 0;
 }
 
 /*
@@ -247,34 +337,27 @@ int parse_fst(int fd, struct gcm_disk_header *dh)
  */
 int main(int argc, char *argv[])
 {
-	int result;
+	struct gcm_stream stream;
 
-	result = read(0, &boot_bin, sizeof(boot_bin));
-	if (result < 0)
-		die("can't read boot.bin: %s", strerror(errno));
+	stream_init(&stream, 0);
+
+	stream_read(&stream, &boot_bin, sizeof(boot_bin), "boot.bin");
 
 	print_disk_header(&boot_bin);
 
-	result = read(0, &bi2_bin, sizeof(bi2_bin));
-	if (result < 0)
-		die("can't read bi2.bin: %s", strerror(errno));
+	stream_read(&stream, &bi2_bin, sizeof(bi2_bin), "bi2.bin");
 
 	print_disk_header_information(&bi2_bin);
 
-	result = lseek(0, 0x2440, SEEK_SET);
-	if (result < 0)
-		die("can't seek to appldr.bin position: %s", strerror(errno));
+	stream_skip_to(&stream, 0x2440, "appldr.bin");
 
-	result = read(0, &appldr_bin, sizeof(appldr_bin));
-	if (result < 0)
-		die("can't read appldr.bin header: %s", strerror(errno));
+	stream_read(&stream, &appldr_bin, sizeof(appldr_bin),
+		    "appldr.bin header");
 
 	print_apploader_header(&appldr_bin);
 
-	result = lseek(0, be32_to_cpu(boot_bin.layout.fst_offset), SEEK_SET);
-	if (result < 0)
-		die("can't seek to fst.bin position: %s", strerror(errno));
+	stream_skip_to(&stream, be32_to_cpu(boot_bin.layout.fst_offset),
+		       "fst.bin");
 
-	parse_fst(0, &boot_bin);
+	parse_fst(&stream, &boot_bin);
 }
-
@@ -33,6 +33,26 @@
 			((((unsigned long)(addr)) + \
 				 DI_ALIGN_SIZE - 1) & DI_ALIGN_MASK)
 
+/* bi2.bin, right after the disk header */
+#define AL_BI2_OFFSET	0x440
+#define AL_BI2_SIZE	0x2000
+
+/*
+ * The system area is read below the top of memory, where fst.bin and
+ * bi2.bin are going to be placed anyway. With GCM_BOOT_NO_FST they are
+ * not, and this stays untouched.
+ */
+#define AL_SYSTEM_AREA_ADDRESS	((void *)(0x81800000 - SYSTEM_AREA_SIZE - \
+					  AL_BI2_SIZE))
+
+/*
+ * Sectors read along with the boot record, in the same place.
+ * Mastering tools usually put the boot catalog among them.
+ */
+#define AL_BOOT_RECORD_SECTOR	17
+#define AL_BOOT_WINDOW_SECTORS	16
+#define AL_BOOT_WINDOW_ADDRESS	AL_SYSTEM_AREA_ADDRESS
+
 /*
  * DVD data structures
  */
@@ -138,6 +158,7 @@ struct apploader_control {
 	uint32_t	fst_offset;
 	uint32_t	fst_size;
 	unsigned long	bi2_address;
+	uint8_t		boot_flags;
 	void		(*report) (char *text, ...);
 };
 
@@ -154,6 +175,9 @@ static struct dolphin_lowmem *lowmem =
 			 (struct dolphin_lowmem *)0x80000000;
 
 static struct apploader_control al_control = { .fst_size = ~0 };
+
+/* lets mkgbi tell that this apploader knows about GCM_BOOT_NO_FST */
+static const char al_tag_no_fst[] __attribute__ ((used)) = GCM_AL_TAG_NO_FST;
 static struct bootloader_control bl_control = { .size = ~0 };
 
 static unsigned char di_buffer[DI_SECTOR_SIZE] __attribute__ ((aligned(32))) =
@@ -269,6 +293,50 @@ static void al_check_dol(struct dol_header *h, int dol_length)
 	return;
 }
 
+/*
+ * Moves data that was read into the system area to its final place.
+ */
+static void al_move(void *dst, void *src, uint32_t len)
+{
+	memmove(dst, src, len);
+	flush_dcache_range(dst, dst + len);
+}
+
+/*
+ * Returns the pending section with the lowest start address, or -1.
+ */
+static int al_next_dol_sect(struct dol_header *h)
+{
+	unsigned long lowest_start = 0xffffffff;
+	int j, k;
+
+	for (j = -1, k = 0; k < DOL_MAX_SECT; k++) {
+		/* continue if section is already done */
+		if ((bl_control.sects_bitmap & (1 << k)) != 0)
+			continue;
+		/* do nothing for non sections */
+		if (!(bl_control.all_sects_bitmap & (1 << k)))
+			continue;
+		/* found new candidate */
+		if (dol_sect_address(h, k) < lowest_start) {
+			lowest_start = dol_sect_address(h, k);
+			j = k;
+		}
+	}
+	return j;
+}
+
+/*
+ * Checks if a section can be read in the same request as the sections
+ * ending at @end in memory and at @disk_end in the DOL file.
+ */
+static int al_dol_sect_follows(struct dol_header *h, int k,
+			       unsigned long end, unsigned long disk_end)
+{
+	return dol_sect_follows(dol_sect_address(h, k), dol_sect_offset(h, k),
+				end, disk_end, h->address_bss, h->size_bss);
+}
+
 /*
  * Checks if the validation entry of the boot catalog is valid.
  */
@@ -313,11 +381,11 @@ static int al_load(void **address, uint32_t *length, uint32_t *offset)
 	struct di_default_entry *default_entry;
 
 	struct gcm_disk_header *disk_header;
-	struct gcm_disk_header_info *disk_header_info;
 
 	struct dol_header *dh;
-	unsigned long lowest_start;
-	int j, k;
+	unsigned long start, end, disk_end;
+	uint32_t sector;
+	int j, k, text;
 
 	int need_more = 1; /* this tells the IPL if we need more data or not */
 
@@ -330,17 +398,17 @@ static int al_load(void **address, uint32_t *length, uint32_t *offset)
 	case 1:
 		al_control.step = 1; /* fix it to a known value */
 
-		/* read sector 17, containing Boot Record Volume */
-		*address = di_buffer;
-		*length = (uint32_t) di_align(sizeof(*br));
-		*offset = 17 * DI_SECTOR_SIZE;
+		/* read sector 17, containing Boot Record Volume, and a few more */
+		*address = AL_BOOT_WINDOW_ADDRESS;
+		*length = AL_BOOT_WINDOW_SECTORS * DI_SECTOR_SIZE;
+		*offset = AL_BOOT_RECORD_SECTOR * DI_SECTOR_SIZE;
 		invalidate_dcache_range(*address, *address + *length);
 
 		al_control.step++;
 		break;
 	case 2:
 		/* boot record volume loaded */
-		br = (struct di_boot_record *)di_buffer;
+		br = (struct di_boot_record *)AL_BOOT_WINDOW_ADDRESS;
 
 		/* check "EL TORITO SPECIFICATION" id */
 		if (memcmp(br->boot_system_id, "EL TORITO SPECIFICATION", 23)) {
@@ -349,6 +417,16 @@ static int al_load(void **address, uint32_t *length, uint32_t *offset)
 
 		le32_to_cpus(&br->boot_catalog_offset);
 
+		/* the boot catalog may have come along with the boot record */
+		sector = br->boot_catalog_offset - AL_BOOT_RECORD_SECTOR;
+		if (br->boot_catalog_offset > AL_BOOT_RECORD_SECTOR &&
+		    sector < AL_BOOT_WINDOW_SECTORS) {
+			memcpy(di_buffer, AL_BOOT_WINDOW_ADDRESS +
+			       sector * DI_SECTOR_SIZE, DI_SECTOR_SIZE);
+			al_control.step++;
+			goto catalog;
+		}
+
 		/* read the boot catalog */
 		*address = di_buffer;
 		*length = DI_SECTOR_SIZE;
@@ -359,7 +437,7 @@ static int al_load(void **address, uint32_t *length, uint32_t *offset)
 		break;
 	case 3:
 		/* boot catalog loaded */
-
+catalog:
 		/* check validation entry */
 		validation_entry = (struct di_validation_entry *)di_buffer;
 		al_check_validation_entry(validation_entry);
@@ -407,31 +485,34 @@ static int al_load(void **address, uint32_t *length, uint32_t *offset)
 		 * strictly necessary on DOLs with unaligned lengths.
 		 */
 
-		/* find lowest start address for a pending section */
-		lowest_start = 0xffffffff;
-		for (j = -1, k = 0; k < DOL_MAX_SECT; k++) {
-			/* continue if section is already done */
-			if ((bl_control.sects_bitmap & (1 << k)) != 0)
-				continue;
-			/* do nothing for non sections */
-			if (!(bl_control.all_sects_bitmap & (1 << k)))
-				continue;
-			/* found new candidate */
-			if (dol_sect_address(dh, k) < lowest_start) {
-				lowest_start = dol_sect_address(dh, k);
-				j = k;
-			}
-		}
-		/* mark section as being loaded */
+		/* request the lowest pending .dol section */
+		j = al_next_dol_sect(dh);
 		bl_control.sects_bitmap |= (1 << j);
 
-		/* request a .dol section */
-		*address = (void *)dol_sect_address(dh, j);;
-		*length = (uint32_t) di_align(dol_sect_size(dh, j));
+		start = dol_sect_address(dh, j);
+		end = start + (unsigned long)di_align(dol_sect_size(dh, j));
+		disk_end = dol_sect_offset(dh, j) +
+			   (unsigned long)di_align(dol_sect_size(dh, j));
+		text = dol_sect_is_text(dh, j);
+
+		/* and the ones following it, while the IPL can read them along */
+		while ((k = al_next_dol_sect(dh)) >= 0 &&
+		       al_dol_sect_follows(dh, k, end, disk_end)) {
+			bl_control.sects_bitmap |= (1 << k);
+
+			end = dol_sect_address(dh, k) +
+			      (unsigned long)di_align(dol_sect_size(dh, k));
+			disk_end = dol_sect_offset(dh, k) +
+				   (unsigned long)di_align(dol_sect_size(dh, k));
+			text |= dol_sect_is_text(dh, k);
+		}
+
+		*address = (void *)start;
+		*length = end - start;
 		*offset = bl_control.offset + dol_sect_offset(dh, j);
 
 		invalidate_dcache_range(*address, *address + *length);
-		if (dol_sect_is_text(dh, j))
+		if (text)
 			invalidate_icache_range(*address, *address + *length);
 
 		/* check if we are going to be done with all sections */
@@ -448,59 +529,100 @@ static int al_load(void **address, uint32_t *length, uint32_t *offset)
 	case 5:
 		/* all .dol sections loaded */
 
-		/* read sector 0, containing disk header and disk header info */
+		/* read the disk header, to learn what the payload needs */
 		*address = di_buffer;
-		*length = (uint32_t) di_align(sizeof(*disk_header) + sizeof(*disk_header_info));
+		*length = DI_SECTOR_SIZE;
 		*offset = 0;
 		invalidate_dcache_range(*address, *address + *length);
 
 		al_control.step++;
 		break;
 	case 6:
-		/* boot.bin and bi2.bin header loaded */
+		/* disk header loaded */
 
 		disk_header = (struct gcm_disk_header *)di_buffer;
-		disk_header_info = (struct gcm_disk_header_info *)(di_buffer + sizeof(*disk_header));
+
+		/*
+		 * Leave fst.bin and bi2.bin alone if the payload won't use
+		 * them. Nothing is staged then, as the .dol may well be using
+		 * the top of memory.
+		 */
+		al_control.boot_flags = disk_header->info.boot_flags;
+		if (al_control.boot_flags & GCM_BOOT_NO_FST) {
+			al_control.step += 2;
+			goto finish;
+		}
 
 		al_control.fst_offset = disk_header->layout.fst_offset;
 		al_control.fst_size = disk_header->layout.fst_size;
 		al_control.fst_address = (0x81800000 - al_control.fst_size) & DI_ALIGN_MASK;
+		al_control.bi2_address = al_control.fst_address - AL_BI2_SIZE;
 
-		/* read fst.bin */
-		*address = (void *)al_control.fst_address;
-		*length = (uint32_t) di_align(al_control.fst_size);
-		*offset = al_control.fst_offset;
+		/* read the rest of the system area: bi2.bin and usually fst.bin */
+		memcpy(AL_SYSTEM_AREA_ADDRESS, di_buffer, DI_SECTOR_SIZE);
+		*address = AL_SYSTEM_AREA_ADDRESS + DI_SECTOR_SIZE;
+		*length = SYSTEM_AREA_SIZE - DI_SECTOR_SIZE;
+		*offset = DI_SECTOR_SIZE;
 		invalidate_dcache_range(*address, *address + *length);
 
 		al_control.step++;
 		break;
 	case 7:
-		/* fst.bin loaded */
+		/* system area loaded */
+
+		/*
+		 * The FST lands above the staged bi2.bin, so it is moved first.
+		 * bi2.bin may then be moved over the staged FST.
+		 */
+		if (al_control.fst_offset >= AL_BI2_OFFSET + AL_BI2_SIZE &&
+		    al_control.fst_offset + (unsigned long)
+			di_align(al_control.fst_size) <= SYSTEM_AREA_SIZE) {
+			al_move((void *)al_control.fst_address,
+				AL_SYSTEM_AREA_ADDRESS + al_control.fst_offset,
+				(uint32_t) di_align(al_control.fst_size));
+			al_move((void *)al_control.bi2_address,
+				AL_SYSTEM_AREA_ADDRESS + AL_BI2_OFFSET,
+				AL_BI2_SIZE);
+
+			/* all done, no need to bother the drive again */
+			al_control.step++;
+			goto finish;
+		}
 
-		al_control.bi2_address = al_control.fst_address - 0x2000;
+		/* bi2.bin must be out of the way before reading fst.bin */
+		al_move((void *)al_control.bi2_address,
+			AL_SYSTEM_AREA_ADDRESS + AL_BI2_OFFSET, AL_BI2_SIZE);
 
-		/* read bi2.bin */
-		*address = (void *)al_control.bi2_address;
-		*length = 0x2000;
-		*offset = 0x440;
+		/* read fst.bin */
+		*address = (void *)al_control.fst_address;
+		*length = (uint32_t) di_align(al_control.fst_size);
+		*offset = al_control.fst_offset;
 		invalidate_dcache_range(*address, *address + *length);
 
 		al_control.step++;
 		break;
 	case 8:
-		/* bi2.bin loaded */
-
+		/* fst.bin and bi2.bin in place */
+finish:
 		lowmem->a_boot_magic = 0x0d15ea5e;
 		lowmem->a_version = 1;
 
-		lowmem->a_arena_hi = al_control.fst_address;
-		lowmem->a_fst = (void *)al_control.fst_address;
-		lowmem->a_fst_max_size = al_control.fst_size;
+		if (al_control.boot_flags & GCM_BOOT_NO_FST) {
+			/* everything up to the debug monitor is arena */
+			lowmem->a_arena_hi = 0x81800000;
+			lowmem->a_fst = NULL;
+			lowmem->a_fst_max_size = 0;
+			lowmem->a_bi2 = NULL;
+		} else {
+			lowmem->a_arena_hi = al_control.fst_address;
+			lowmem->a_fst = (void *)al_control.fst_address;
+			lowmem->a_fst_max_size = al_control.fst_size;
+			lowmem->a_bi2 = (void *)al_control.bi2_address;
+		}
 		//memset(&lowmem->a_debugger_info, 0, sizeof(struct dolphin_debugger_info));
 		//lowmem->a_debug_monitor_size = 0;
 		lowmem->a_debug_monitor = (void *)0x81800000;
 		lowmem->a_simulated_memory_size = 0x01800000;
-		lowmem->a_bi2 = (void *)al_control.bi2_address;
 		flush_dcache_range(lowmem, lowmem+1);
 
 #if PATCH_IPL
@@ -0,0 +1,185 @@
+/*
+ * lcdma.c
+ *
+ * Memory to memory copies through the Gekko locked cache dma engine.
+ *
+ * Copyright (C) 2005-2006 The GameCube Linux Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+/*
+ * When enabled, half of the data cache becomes a 16KB scratchpad (the
+ * locked cache) mapped at LC_BASE. A dma engine moves whole cache lines
+ * between it and main memory on its own, taking commands from a queue.
+ *
+ * Commands are run in order, so a copy is just a stream of load/store
+ * pairs through two alternating buffers, and the core only has to keep
+ * the queue fed.
+ *
+ */
+
+#include "../include/system.h"
+#include "../include/lcdma.h"
+
+#define SPRN_PVR	287
+#define SPRN_HID2	920
+#define SPRN_DMAU	922
+#define SPRN_DMAL	923
+#define SPRN_DBAT3U	542
+#define SPRN_DBAT3L	543
+
+#define HID2_LCE	(1<<28)		/* locked cache enable */
+#define HID2_DMAQL(hid2) (((hid2) >> 24) & 0xf)	/* dma queue length */
+
+#define DMA_QUEUE_MAX	15
+
+#define DMAL_LD		(1<<4)		/* memory to locked cache */
+#define DMAL_T		(1<<1)		/* trigger */
+
+#ifdef SDRE_HOST
+/* the registers and the locked cache are modelled, see host.h */
+#define sync()		do { } while (0)
+#define isync()		do { } while (0)
+#else
+
+#define mfspr(rn)	({unsigned long rval; \
+			asm volatile("mfspr %0," __stringify(rn) \
+				     : "=r" (rval)); rval;})
+#define mtspr(rn, v)	asm volatile("mtspr " __stringify(rn) ",%0" \
+				     : : "r" (v))
+
+#define __stringify_1(x)	#x
+#define __stringify(x)		__stringify_1(x)
+
+#define sync()		asm volatile("sync")
+#define isync()		asm volatile("isync")
+
+/*
+ * Establishes a locked cache line, without reading memory.
+ */
+static inline void dcbz_l(unsigned long address)
+{
+	register unsigned long r3 asm("r3") = address;
+
+	/* dcbz_l 0,r3 */
+	asm volatile(".long 0x10001fec" : : "r" (r3) : "memory");
+}
+
+static inline void dcbi(unsigned long address)
+{
+	asm volatile("dcbi 0,%0" : : "r" (address) : "memory");
+}
+
+#endif				/* SDRE_HOST */
+
+/*
+ * Only the Gekko and its successors have the locked cache.
+ */
+int lc_dma_available(void)
+{
+	unsigned long pvr = mfspr(SPRN_PVR) >> 12;
+
+	return pvr == 0x83 || pvr == 0x87;
+}
+
+/*
+ * Maps the locked cache and makes it ready for dma.
+ * The previous DBAT3 mapping is saved in state, which the caller keeps
+ * (on its stack, say) until lc_dma_disable().
+ */
+void lc_dma_enable(struct lc_dma_state *state)
+{
+	unsigned long address;
+
+	state->dbat3u = mfspr(SPRN_DBAT3U);
+	state->dbat3l = mfspr(SPRN_DBAT3L);
+
+	/*
+	 * Half of the data cache is taken away from memory, and modified
+	 * lines in there would be lost, the stack among them.
+	 */
+	flush_dcache_all();
+
+	sync();
+	mtspr(SPRN_HID2, mfspr(SPRN_HID2) | HID2_LCE);
+
+	/* 0xe0000000, read/write, supervisor only */
+	mtspr(SPRN_DBAT3L, LC_BASE | 0x0002);
+	mtspr(SPRN_DBAT3U, LC_BASE | 0x01fe);
+	isync();
+
+	for (address = LC_BASE; address < LC_BASE + LC_SIZE;
+	     address += L1_CACHE_LINE_SIZE)
+		dcbz_l(address);
+}
+
+/*
+ * Gives the locked cache back to the data cache.
+ */
+void lc_dma_disable(struct lc_dma_state *state)
+{
+	unsigned long address;
+
+	for (address = LC_BASE; address < LC_BASE + LC_SIZE;
+	     address += L1_CACHE_LINE_SIZE)
+		dcbi(address);
+
+	mtspr(SPRN_HID2, mfspr(SPRN_HID2) & ~HID2_LCE);
+
+	mtspr(SPRN_DBAT3U, state->dbat3u);
+	mtspr(SPRN_DBAT3L, state->dbat3l);
+	isync();
+}
+
+/*
+ * Waits until no more than len commands are queued.
+ */
+static inline void lc_dma_wait(unsigned long len)
+{
+	while (HID2_DMAQL(mfspr(SPRN_HID2)) > len)
+		;
+}
+
+/*
+ * Queues a dma command. Memory is addressed physically.
+ */
+static inline void lc_dma_queue(unsigned long lc, const void *mem,
+				unsigned long blocks, unsigned long dir)
+{
+	mtspr(SPRN_DMAU, ((unsigned long)mem & 0x0fffffe0) |
+			 ((blocks >> 2) & 0x1f));
+	mtspr(SPRN_DMAL, lc | ((blocks & 3) << 2) | dir | DMAL_T);
+}
+
+/*
+ * Copies len bytes from src to dst through the locked cache.
+ * Both must be cache line aligned, and len a multiple of the line size.
+ * The data cache must not hold dirty lines of src nor any line of dst.
+ */
+void lc_dma_copy(void *dst, const void *src, unsigned long len)
+{
+	unsigned long buf = LC_BASE;
+	unsigned long chunk;
+
+	while (len) {
+		chunk = (len > LC_DMA_CHUNK) ? LC_DMA_CHUNK : len;
+
+		/* room for a load and a store */
+		lc_dma_wait(DMA_QUEUE_MAX - 2);
+		lc_dma_queue(buf, src, chunk >> LG_L1_CACHE_LINE_SIZE,
+			     DMAL_LD);
+		lc_dma_queue(buf, dst, chunk >> LG_L1_CACHE_LINE_SIZE, 0);
+
+		/* alternate between two buffers */
+		buf ^= LC_DMA_CHUNK;
+		src += chunk;
+		dst += chunk;
+		len -= chunk;
+	}
+	lc_dma_wait(0);
+}
@@ -13,29 +13,180 @@
 
 #include "../include/system.h"
 
-void *memcpy(void *dest, const void *src, int count)
+/* dcbz faults on cache inhibited memory, so keep it to cached RAM */
+#define in_cached_ram(p, len) \
+	((len) <= GCN_RAM_SIZE && \
+	 (unsigned long)(p) - 0x80000000UL <= GCN_RAM_SIZE - (len))
+
+#define LINE_WORDS	(L1_CACHE_LINE_SIZE / sizeof(uint32_t))
+
+/*
+ * Copies a cache line worth of words.
+ */
+static inline void copy_line(uint32_t *d, const uint32_t *s)
+{
+	uint32_t w0, w1, w2, w3, w4, w5, w6, w7;
+
+	w0 = s[0]; w1 = s[1]; w2 = s[2]; w3 = s[3];
+	w4 = s[4]; w5 = s[5]; w6 = s[6]; w7 = s[7];
+	d[0] = w0; d[1] = w1; d[2] = w2; d[3] = w3;
+	d[4] = w4; d[5] = w5; d[6] = w6; d[7] = w7;
+}
+
+/*
+ * Bytes are moved a word at a time, and a cache line at a time where
+ * possible, as long as src and dest share their alignment.
+ * Destination lines are claimed with dcbz, so they are never read in
+ * from memory, unless src is within reach of them.
+ */
+void *memcpy(void *dest, const void *src, size_t count)
 {
 	char *tmp = (char *)dest, *s = (char *)src;
+	uint32_t *d32, *s32;
+	int zero_lines;
+
+	if (count >= 2 * sizeof(uint32_t) &&
+	    !(((unsigned long)tmp ^ (unsigned long)s) & 3)) {
+		while ((unsigned long)tmp & 3) {
+			*tmp++ = *s++;
+			count--;
+		}
+		d32 = (uint32_t *)tmp;
+		s32 = (uint32_t *)s;
+
+		if (count >= L1_CACHE_LINE_SIZE) {
+			while ((unsigned long)d32 & (L1_CACHE_LINE_SIZE - 1)) {
+				*d32++ = *s32++;
+				count -= sizeof(uint32_t);
+			}
+			zero_lines = in_cached_ram(d32, count) &&
+				     ((char *)s32 >= (char *)d32 + count ||
+				      (char *)s32 + count <= (char *)d32);
+			while (count >= L1_CACHE_LINE_SIZE) {
+				if (zero_lines)
+					dcbz(d32);
+				copy_line(d32, s32);
+				d32 += LINE_WORDS;
+				s32 += LINE_WORDS;
+				count -= L1_CACHE_LINE_SIZE;
+			}
+		}
+		while (count >= sizeof(uint32_t)) {
+			*d32++ = *s32++;
+			count -= sizeof(uint32_t);
+		}
+		tmp = (char *)d32;
+		s = (char *)s32;
+	}
 
 	while (count--)
 		*tmp++ = *s++;
 	return dest;
 }
 
-int memcmp(const void *cs, const void *ct, int count)
+void *memmove(void *dest, const void *src, size_t count)
+{
+	char *tmp, *s;
+	uint32_t *d32, *s32;
+
+	if (dest <= src || (char *)dest >= (char *)src + count)
+		return memcpy(dest, src, count);
+
+	tmp = (char *)dest + count;
+	s = (char *)src + count;
+
+	/* backwards, a word at a time if the alignment allows */
+	if (count >= 2 * sizeof(uint32_t) &&
+	    !(((unsigned long)tmp ^ (unsigned long)s) & 3)) {
+		while ((unsigned long)tmp & 3) {
+			*--tmp = *--s;
+			count--;
+		}
+		d32 = (uint32_t *)tmp;
+		s32 = (uint32_t *)s;
+		while (count >= sizeof(uint32_t)) {
+			*--d32 = *--s32;
+			count -= sizeof(uint32_t);
+		}
+		tmp = (char *)d32;
+		s = (char *)s32;
+	}
+
+	while (count--)
+		*--tmp = *--s;
+	return dest;
+}
+
+int memcmp(const void *cs, const void *ct, size_t count)
 {
 	const unsigned char *su1, *su2;
 	int res = 0;
 
-	for (su1 = cs, su2 = ct; 0 < count; ++su1, ++su2, count--)
+	su1 = cs;
+	su2 = ct;
+
+	/* skip equal words, the bytes tell the difference */
+	if (!(((unsigned long)su1 | (unsigned long)su2) & 3)) {
+		while (count >= sizeof(uint32_t) &&
+		       *(const uint32_t *)su1 == *(const uint32_t *)su2) {
+			su1 += sizeof(uint32_t);
+			su2 += sizeof(uint32_t);
+			count -= sizeof(uint32_t);
+		}
+	}
+
+	for (; 0 < count; ++su1, ++su2, count--)
 		if ((res = *su1 - *su2) != 0)
 			break;
 	return res;
 }
 
-void *memset(void *s, int c, int count)
+/*
+ * Fills a word at a time. Whole cache lines of zeroes are just
+ * claimed with dcbz, without ever touching memory.
+ */
+void *memset(void *s, int c, size_t count)
 {
 	char *xs = (char *)s;
+	uint32_t *x32;
+	uint32_t w;
+
+	if (count >= 2 * sizeof(uint32_t)) {
+		while ((unsigned long)xs & 3) {
+			*xs++ = c;
+			count--;
+		}
+		x32 = (uint32_t *)xs;
+
+		w = (unsigned char)c;
+		w |= w << 8;
+		w |= w << 16;
+
+		if (count >= L1_CACHE_LINE_SIZE) {
+			while ((unsigned long)x32 & (L1_CACHE_LINE_SIZE - 1)) {
+				*x32++ = w;
+				count -= sizeof(uint32_t);
+			}
+			if (!w && in_cached_ram(x32, count)) {
+				while (count >= L1_CACHE_LINE_SIZE) {
+					dcbz(x32);
+					x32 += LINE_WORDS;
+					count -= L1_CACHE_LINE_SIZE;
+				}
+			}
+			while (count >= L1_CACHE_LINE_SIZE) {
+				x32[0] = w; x32[1] = w; x32[2] = w; x32[3] = w;
+				x32[4] = w; x32[5] = w; x32[6] = w; x32[7] = w;
+				x32 += LINE_WORDS;
+				count -= L1_CACHE_LINE_SIZE;
+			}
+		}
+		while (count >= sizeof(uint32_t)) {
+			*x32++ = w;
+			count -= sizeof(uint32_t);
+		}
+		xs = (char *)x32;
+	}
 
 	while (count--)
 		*xs++ = c;
@@ -43,6 +194,33 @@ void *memset(void *s, int c, int count)
 	return s;
 }
 
+/*
+ * Copies len bytes from src to dst and gets them ready to be executed.
+ * Whole cache lines are handled in a single pass by copy_sync_lines(),
+ * when the alignment allows it and dst doesn't run into src.
+ */
+void copy_sync_range(void *dst, const void *src, unsigned long len)
+{
+	unsigned long lines = 0;
+	char *d = dst;
+	const char *s = src;
+
+	if (!((unsigned long)d & (L1_CACHE_LINE_SIZE - 1)) &&
+	    !((unsigned long)s & 3) &&
+	    (s >= d + L1_CACHE_LINE_SIZE || s + len <= d)) {
+		lines = len & ~(L1_CACHE_LINE_SIZE - 1);
+		copy_sync_lines(d, s, lines);
+		d += lines;
+		s += lines;
+	}
+
+	if (lines < len) {
+		memcpy(d, s, len - lines);
+		flush_dcache_range(d, d + (len - lines));
+		invalidate_icache_range(d, d + (len - lines));
+	}
+}
+
 void rumble(int enable)
 {
 	writel(0x00400000 | ((enable) ? 1 : 0), GCN_SI_C0OUTBUF);
@@ -54,9 +232,11 @@ void rumble_on(void)
 	rumble(1);
 }
 
+#ifndef SDRE_HOST
 void panic(char *text)
 {
 	rumble(1);
 	for (;;) ;
 }
+#endif
 
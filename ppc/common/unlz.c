@@ -0,0 +1,62 @@
+/*
+ * unlz.c
+ *
+ * Minimal LZ4 block decompressor.
+ *
+ * Copyright (C) 2005-2006 The GameCube Linux Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+#include "../include/unlz.h"
+
+/*
+ * Decompresses src_length bytes of LZ4 block data from src into dst.
+ * The input is trusted, it was built by udolrel.
+ * Returns the number of bytes written.
+ */
+uint32_t unlz(void *dst, const void *src, uint32_t src_length)
+{
+	const uint8_t *ip = src, *ip_end = ip + src_length;
+	uint8_t *op = dst, *match;
+	uint32_t token, len, c;
+
+	while (ip < ip_end) {
+		token = *ip++;
+
+		/* literals */
+		len = token >> 4;
+		if (len == 15) {
+			do {
+				c = *ip++;
+				len += c;
+			} while (c == 255);
+		}
+		while (len--)
+			*op++ = *ip++;
+
+		/* the last sequence has no match */
+		if (ip >= ip_end)
+			break;
+
+		match = op - (ip[0] | (ip[1] << 8));
+		ip += 2;
+
+		len = token & 15;
+		if (len == 15) {
+			do {
+				c = *ip++;
+				len += c;
+			} while (c == 255);
+		}
+		len += 4;
+		while (len--)
+			*op++ = *match++;
+	}
+
+	return op - (uint8_t *)dst;
+}
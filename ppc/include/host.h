@@ -0,0 +1,62 @@
+/*
+ * host.h
+ *
+ * Hardware access for host builds of the relocation engine.
+ * Copyright (C) 2005-2006 The GameCube Linux Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+#ifndef __HOST_H
+#define __HOST_H
+
+#include <stdint.h>
+#include <string.h>	/* the mem* prototypes */
+#include <byteswap.h>
+
+/*
+ * Register accesses and the timebase are routed to the device models
+ * of the host program. Memory is mapped at its usual addresses.
+ */
+extern unsigned long readl(volatile void *addr);
+extern void writel(unsigned long b, volatile void *addr);
+extern unsigned long ticks(void);
+
+extern unsigned long host_msr;
+
+/* so are the special purpose registers and the locked cache */
+extern unsigned long mfspr(int rn);
+extern void mtspr(int rn, unsigned long v);
+extern void dcbz_l(unsigned long address);
+extern void dcbi(unsigned long address);
+
+#define mtmsr(v)	do { host_msr = (v); } while (0)
+#define mfmsr()		(host_msr)
+
+/* same results as the byte reversed stores on the big endian target */
+static inline void st_le16(volatile uint16_t * addr, const uint16_t val)
+{
+	*addr = bswap_16(val);
+}
+
+static inline void st_le32(volatile uint32_t * addr, const uint32_t val)
+{
+	*addr = bswap_32(val);
+}
+
+/* a cache line of zeroes, without relying on the mem* routines */
+static inline void dcbz(void *addr)
+{
+	uint32_t *line = (uint32_t *)((unsigned long)addr &
+				      ~(L1_CACHE_LINE_SIZE - 1));
+	unsigned int i;
+
+	for (i = 0; i < L1_CACHE_LINE_SIZE / sizeof(uint32_t); i++)
+		line[i] = 0;
+}
+
+#endif /* __HOST_H */
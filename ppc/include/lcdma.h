@@ -0,0 +1,35 @@
+/*
+ * lcdma.h
+ *
+ * Copyright (C) 2005-2006 The GameCube Linux Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+#ifndef __LCDMA_H
+#define __LCDMA_H
+
+#include <stdint.h>
+
+#define LC_BASE			0xe0000000
+#define LC_SIZE			(16*1024)
+
+/* a single dma command moves up to 128 cache lines */
+#define LC_DMA_MAX_BLOCKS	128
+#define LC_DMA_CHUNK		(LC_DMA_MAX_BLOCKS * L1_CACHE_LINE_SIZE)
+
+/* what the locked cache takes over, restored when it is given back */
+struct lc_dma_state {
+	unsigned long dbat3u, dbat3l;
+};
+
+extern int lc_dma_available(void);
+extern void lc_dma_enable(struct lc_dma_state *state);
+extern void lc_dma_disable(struct lc_dma_state *state);
+extern void lc_dma_copy(void *dst, const void *src, unsigned long len);
+
+#endif /* __LCDMA_H */
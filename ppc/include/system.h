@@ -15,6 +15,8 @@
 
 #define L1_CACHE_LINE_SIZE	32
 #define LG_L1_CACHE_LINE_SIZE	5
+#define L1_ICACHE_SIZE		(32*1024)
+#define L2_CACHE_SIZE		(256*1024)
 
 #define GCN_VIDEO_LINES		480
 
@@ -54,6 +56,11 @@
 #define le16_to_cpus(addr) st_le16(addr, *addr)
 #define le32_to_cpus(addr) st_le32(addr, *addr)
 
+#ifdef SDRE_HOST
+/* host builds reach the hardware through a shim, see sdresim */
+#include "host.h"
+#else
+
 static inline void st_le16(volatile uint16_t * addr, const uint16_t val)
 {
 	asm volatile ("sthbrx %1,0,%2":"=m" (*addr):"r"(val), "r"(addr));
@@ -82,9 +89,20 @@ static inline unsigned long ticks(void)
 	return tbl;
 }
 
+static inline void dcbz(void *addr)
+{
+	asm volatile ("dcbz 0,%0" : : "r"(addr) : "memory");
+}
+
+#endif				/* SDRE_HOST */
+
 extern void flush_dcache_range(void *start, void *stop);
 extern void invalidate_dcache_range(void *start, void *stop);
 extern void invalidate_icache_range(void *start, void *stop);
+extern void flush_dcache_all(void);
+extern void invalidate_icache_all(void);
+extern void copy_sync_lines(void *dst, const void *src, unsigned long len);
+extern void copy_sync_range(void *dst, const void *src, unsigned long len);
 
 extern void rumble(int enable);
 extern void rumble_on(void);
@@ -0,0 +1,20 @@
+/*
+ * unlz.h
+ *
+ * Copyright (C) 2005-2006 The GameCube Linux Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+#ifndef __UNLZ_H
+#define __UNLZ_H
+
+#include <stdint.h>
+
+extern uint32_t unlz(void *dst, const void *src, uint32_t src_length);
+
+#endif /* __UNLZ_H */
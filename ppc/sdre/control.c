@@ -5,5 +5,14 @@
 
 #include "../../include/dolrel.h"
 
-struct dolrel_control __dolrel_control = { .version = 0xdead0001, };
+/*
+ * The control header ends the stub image, udolrel appends the relocation
+ * table right after it. The ldscript places its section past _end, so
+ * that clearing .bss can't wipe the start of the table.
+ */
+struct dolrel_control __dolrel_control
+	__attribute__((section(".dolrel_control"))) = {
+	.version = DOLREL_VERSION,
+	.flags = SDRE_FLAGS,
+};
 
@@ -176,6 +176,9 @@
 #define HID1_SYNCBE	(1<<11)		/* 7450 ABE for sync, eieio */
 #define HID1_ABE	(1<<10)		/* 7450 Address Broadcast Enable */
 #define SPRN_HID2	0x3F8		/* Hardware Implementation Register 2 */
+#define HID2_LSQE	(1<<31)		/* Gekko Load/Store Quantized Enable */
+#define HID2_WPE	(1<<30)		/* Gekko Write Gather Pipe Enable */
+#define HID2_PSE	(1<<29)		/* Gekko Paired Singles Enable */
 #define SPRN_IABR	0x3F2	/* Instruction Address Breakpoint Register */
 #define SPRN_HID4	0x3F4		/* 970 HID4 */
 #define SPRN_HID5	0x3F6		/* 970 HID5 */
@@ -16,13 +16,22 @@
 
 #include "../include/system.h"
 #include "../include/debug.h"
+#include "../include/unlz.h"
+#include "../include/lcdma.h"
+
+#ifdef SDRE_HOST
+/* the host build takes the control header from the image it loaded */
+#define __dolrel_control (*sdre_host_control)
+#endif
 
 #include "../../include/dolrel.h"
 
 
+#ifndef SDRE_HOST
 #define mtmsr(v)        asm volatile("mtmsr %0" : : "r" (v))
 #define mfmsr()         ({unsigned long rval; \
                         asm volatile("mfmsr %0" : "=r" (rval)); rval;})
+#endif
 
 #define __MASK(X)       (1UL<<(X))
 
@@ -109,20 +118,60 @@ static inline void local_irq_disable(void)
 #define CMDBUF(a,b,c,d) (((a)<<24)|((b)<<16)|((c)<<8)|(d))
 
 
+/* the timebase runs at a quarter of the 162MHz bus clock */
+#define TB_TICKS_PER_MSEC	(162000 / 4)
+
+#define msecs_to_ticks(ms)	((ms) * TB_TICKS_PER_MSEC)
+#define usecs_to_ticks(us)	((us) * (TB_TICKS_PER_MSEC / 100) / 10)
+
+#define DI_RESET_HOLD_USECS	12
+#define DI_RESET_TIMEOUT_MSECS	2000
+#define DI_COMMAND_TIMEOUT_MSECS 10000
+
+/*
+ * The drivechip needs some time to transfer the apploader patch, its
+ * reset logic word tells when it is done. The original code waited a
+ * fixed 8 secs before looking at it. Should a drivechip need such a
+ * grace period, udolrel can ask for one in the control header.
+ */
+#define XENOGC_POLL_MSECS	100
+#define XENOGC_TIMEOUT_MSECS	18000
+
 /*
  *
  */
-static void mdelay(int msecs)
+static void udelay(unsigned long usecs)
 {
-	const unsigned long ticks_per_msec = 162000 / 4;
-	unsigned long start_ticks, loops;
+	unsigned long start_ticks;
 
-	loops = msecs * ticks_per_msec;
 	start_ticks = ticks();
-	while(ticks() - start_ticks < loops)
+	while (ticks() - start_ticks < usecs_to_ticks(usecs))
 		;
 }
 
+/*
+ * Records how long a wait took, so it can be tuned.
+ * For repeated waits, the longest one is kept.
+ */
+static void record_wait(int which, unsigned long start_ticks)
+{
+	unsigned long elapsed = ticks() - start_ticks;
+
+	if (elapsed > __dolrel_control.wait_ticks[which])
+		__dolrel_control.wait_ticks[which] = elapsed;
+}
+
+/* boot stage timestamps, right below the stub */
+#define timing	((struct dolrel_timing *)DOLREL_TIMING_ADDRESS)
+
+/*
+ * Marks the end of a boot stage.
+ */
+static inline void stamp(int which)
+{
+	timing->stamps[which] = ticks();
+}
+
 
 /*
  * DI
@@ -135,13 +184,13 @@ static void mdelay(int msecs)
 static void di_reset(void)
 {
         unsigned long *reset_reg = (unsigned long *)0xcc003024;
-        unsigned long reset, i;
+        unsigned long reset;
 
 #define FLIPPER_RESET_DVD 0x00000004
 
         reset = readl(reset_reg);
         writel((reset & ~FLIPPER_RESET_DVD) | 1, reset_reg);
-        for (i = 0; i < 0xfffff; i++) ;
+        udelay(DI_RESET_HOLD_USECS);
         writel((reset | FLIPPER_RESET_DVD) | 1, reset_reg);
 }
 
@@ -170,8 +219,47 @@ static void di_quiesce(void)
 	local_irq_restore(flags);
 }
 
+/* set while a command started with __DI_DONT_WAIT is in flight */
+static int di_pending;
+
+/*
+ * Waits for the command in flight, if any, and acks it.
+ */
+static int di_wait_command(void)
+{
+        unsigned long *sr_reg = io_base + DI_SR;
+        unsigned long *cr_reg = io_base + DI_CR;
+        unsigned long start_ticks;
+        int result = 0;
+
+        if (!di_pending)
+                return 0;
+
+        /* busy-wait, but not forever */
+        start_ticks = ticks();
+        while ((readl(cr_reg) & DI_CR_TSTART)) {
+                if (ticks() - start_ticks >
+                    msecs_to_ticks(DI_COMMAND_TIMEOUT_MSECS)) {
+                        result = -1;
+                        break;
+                }
+        }
+        record_wait(DOLREL_WAIT_DI_COMMAND, start_ticks);
+
+        if ((readl(sr_reg) & DI_SR_DEINT))
+                result = -1;
+
+        /* ack interrupts */
+        writel(readl(sr_reg) | (DI_SR_DEINT | DI_SR_TCINT), sr_reg);
+        di_pending = 0;
+
+        return result;
+}
+
 /*
  * Runs a DI command.
+ * With __DI_DONT_WAIT the command is just started, and di_wait_command()
+ * must be called before touching the drive or the transfer buffer again.
  */
 static int di_run_command(unsigned long *cmdbuf, void *data, int len, int mode)
 {
@@ -179,6 +267,9 @@ static int di_run_command(unsigned long *cmdbuf, void *data, int len, int mode)
         unsigned long *cr_reg = io_base + DI_CR;
         int result = 0;
 
+        /* one command at a time */
+        di_wait_command();
+
         writel(cmdbuf[0], io_base + DI_CMDBUF0);
         writel(cmdbuf[1], io_base + DI_CMDBUF1);
         writel(cmdbuf[2], io_base + DI_CMDBUF2);
@@ -198,17 +289,12 @@ static int di_run_command(unsigned long *cmdbuf, void *data, int len, int mode)
 
                 /* start the transfer */
                 writel(mode & 0x7, cr_reg);
+                di_pending = 1;
 
-                if (!(mode & __DI_DONT_WAIT)) {
-                        /* busy-wait */
-                        while ((readl(cr_reg) & DI_CR_TSTART)) ;
+                if ((mode & __DI_DONT_WAIT))
+                        return 0;
 
-                        if ((readl(sr_reg) & DI_SR_DEINT))
-                                result = -1;
-                }
-
-                /* ack interrupts */
-                writel(readl(sr_reg) | (DI_SR_DEINT | DI_SR_TCINT), sr_reg);
+                result = di_wait_command();
         }
 
         if (mode & DI_CR_DMA) {
@@ -220,7 +306,7 @@ static int di_run_command(unsigned long *cmdbuf, void *data, int len, int mode)
 }
 
 /*
- * Stop the drive motor.
+ * Starts stopping the drive motor, without waiting for the drive.
  */
 static unsigned long di_stop_motor(void)
 {
@@ -228,25 +314,44 @@ static unsigned long di_stop_motor(void)
 
         cmdbuf[0] = 0xe3000000;
         cmdbuf[1] = cmdbuf[2] = 0;
-        return di_run_command(cmdbuf, 0, 0, DI_CR_TSTART);
+        return di_run_command(cmdbuf, 0, 0, DI_CR_TSTART | __DI_DONT_WAIT);
 }
 
 /*
- * Enables the "debug" command set.
+ * Tells if the command in flight, if any, is over, without waiting.
  */
-static int di_enable_debug_commands(void)
+static int di_command_done(void)
 {
-        unsigned long cmdbuf[3];
+	return !di_pending || !(readl(io_base + DI_CR) & DI_CR_TSTART);
+}
 
-        cmdbuf[0] = CMDBUF(0xff, 0x01, 'M', 'A');
-        cmdbuf[1] = CMDBUF('T', 'S', 'H', 'I');
-        cmdbuf[2] = CMDBUF('T', 'A', 0x02, 0x00);
-        di_run_command(cmdbuf, 0, 0, DI_CR_TSTART);
+/*
+ * Starts an immediate command, without waiting for the drive.
+ */
+static void di_start_command(unsigned long cmd0, unsigned long cmd1,
+			     unsigned long cmd2)
+{
+	unsigned long cmdbuf[3];
 
-        cmdbuf[0] = CMDBUF(0xff, 0x00, 'D', 'V');
-        cmdbuf[1] = CMDBUF('D', '-', 'G', 'A');
-        cmdbuf[2] = CMDBUF('M', 'E', 0x03, 0x00);
-        return di_run_command(cmdbuf, 0, 0, DI_CR_TSTART);
+	cmdbuf[0] = cmd0;
+	cmdbuf[1] = cmd1;
+	cmdbuf[2] = cmd2;
+	di_run_command(cmdbuf, 0, 0, DI_CR_TSTART | __DI_DONT_WAIT);
+}
+
+/*
+ * Starts one of the two halves of the "debug" command set unlock.
+ */
+static void di_start_debug_unlock(int half)
+{
+	if (!half)
+		di_start_command(CMDBUF(0xff, 0x01, 'M', 'A'),
+				 CMDBUF('T', 'S', 'H', 'I'),
+				 CMDBUF('T', 'A', 0x02, 0x00));
+	else
+		di_start_command(CMDBUF(0xff, 0x00, 'D', 'V'),
+				 CMDBUF('D', '-', 'G', 'A'),
+				 CMDBUF('M', 'E', 0x03, 0x00));
 }
 
 /*
@@ -256,93 +361,192 @@ static int di_enable_debug_commands(void)
 
 #define DI_DRIVE_IRQ_VECTOR     0x00804c
 
+#define FW_XENOGC_ID		0x40c60a	/* drivechip signature */
+#define FW_XENOGC_RESET		0x40d100	/* drivechip reset logic */
+#define XENOGC_ID		0xf710fff7
+
 /*
- * Reads a long word from drive addressable memory.
- * Requires debug mode enabled.
+ * Starts reading a long word from drive addressable memory.
+ * Requires debug mode enabled. The word is in DI_DATA once done.
  */
-static int di_fw_read_meml(unsigned long *data, unsigned long address)
+static void di_start_fw_read_meml(unsigned long address)
 {
-        unsigned long *data_reg = io_base + DI_DATA;
-        unsigned long cmdbuf[3];
-        int result;
-
-        cmdbuf[0] = 0xfe010000;
-        cmdbuf[1] = address;
-        cmdbuf[2] = 0x00010000;
-        result = di_run_command(cmdbuf, 0, 0, DI_CR_TSTART);
-        if (!result)
-                *data = readl(data_reg);
-
-        return result;
+	di_start_command(0xfe010000, address, 0x00010000);
 }
 
 /*
- * Disables the xenogc drivechip.
+ * Starts disabling the xenogc drivechip.
  */
-static void di_disable_xenogc(void)
+static void di_start_disable_xenogc(void)
 {
-        unsigned long cmdbuf[3];
-
-        cmdbuf[0] = 0x25000000;
-        cmdbuf[1] = cmdbuf[2] = 0;
-        di_run_command(cmdbuf, 0, 0, DI_CR_TSTART);
+	di_start_command(0x25000000, 0, 0);
 }
 
 /*
- * Ensures that the debug features of the drive firmware are working.
+ * The xenogc is looked for, disabled and waited for one drive command
+ * at a time, stepped in between the relocation entries. This way the
+ * motor stop, a drive reset if the debug commands need one, and the
+ * drivechip patch transfer all run while the sections are relocated.
  */
-static int di_test_debug_features(void)
-{
-        int result;
-
-        result = di_enable_debug_commands();
-        if (result) {
-                di_reset();
-                result = di_enable_debug_commands();
-        }
+enum {
+	XENOGC_START,		/* wait for the motor stop */
+	XENOGC_UNLOCK,		/* first half of the debug unlock sent */
+	XENOGC_UNLOCK_2,	/* second half sent */
+	XENOGC_READ,		/* drivechip id or reset logic read sent */
+	XENOGC_DISABLE,		/* disable command sent */
+	XENOGC_BUSY,		/* drivechip busy, until the next poll */
+	XENOGC_DONE,
+};
+
+static struct {
+	int state;
+	int found;			/* the drivechip is there */
+	int reset;			/* the drive had to be reset */
+	uint32_t grace_msecs;
+	unsigned long reset_ticks;	/* when the drive was reset */
+	unsigned long start_ticks;	/* when the drivechip was disabled */
+	unsigned long poll_ticks;	/* when it was last polled */
+} xenogc;
 
-        return result;
+/*
+ * Starts dealing with the xenogc, see sdre_xenogc_step().
+ */
+static void sdre_xenogc_start(uint32_t grace_msecs)
+{
+	xenogc.state = XENOGC_START;
+	xenogc.found = 0;
+	xenogc.reset = 0;
+	if (grace_msecs > XENOGC_TIMEOUT_MSECS)
+		grace_msecs = XENOGC_TIMEOUT_MSECS;
+	xenogc.grace_msecs = grace_msecs;
 }
 
 /*
- * Checks for a xenogc and cleanly disables it.
+ * Moves the xenogc handling a step further, if the drive is ready.
+ * Returns non-zero once done.
+ *
+ * Once disabled, the drivechip needs some time to transfer the apploader
+ * patch, until its reset logic becomes zero. Otherwise, it will misbehave.
+ * It is polled at most every XENOGC_POLL_MSECS meanwhile.
  */
-static void sdre_disable_xenogc(void)
+static int sdre_xenogc_step(void)
 {
-	int i;
-	unsigned long val;
-
-	if (!di_test_debug_features()) {
-	        if (!di_fw_read_meml(&val, 0x40c60a)) {
-	                if (val == 0xf710fff7) {
-				/*
-				 * Disable the drivechip, but leave it enough
-				 * time to xfer the apploader patch.
-				 * Otherwise, it will misbehave.
-				 */
-				di_disable_xenogc();
-				mdelay(8000); /* 8 secs seems enough */
-
-				/*
-				 * Wait for reset logic to become zero.
-				 * (Usually, not needed).
-				 */
-				for(i=0; i < 0x1111; i++) {
-					val = 1;
-        				di_enable_debug_commands();
-	        			di_fw_read_meml(&val, 0x40d100);
-					le32_to_cpus((uint32_t *)&val);
-					val &= 0xffff;
-					if (val == 0x0000)
-						break;
-					rumble(1);
-				}
-				rumble(0);
+	uint32_t word;
+	int result;
+
+	if (xenogc.state == XENOGC_DONE)
+		return 1;
+	if (!di_command_done())
+		return 0;
+	result = di_wait_command();
+
+	switch (xenogc.state) {
+	case XENOGC_START:
+		di_start_debug_unlock(0);
+		xenogc.state = XENOGC_UNLOCK;
+		break;
+	case XENOGC_UNLOCK:
+		di_start_debug_unlock(1);
+		xenogc.state = XENOGC_UNLOCK_2;
+		break;
+	case XENOGC_UNLOCK_2:
+		if (result && !xenogc.found) {
+			/* reset the drive, then retry until it is back */
+			if (!xenogc.reset) {
+				di_reset();
+				xenogc.reset = 1;
+				xenogc.reset_ticks = ticks();
+			} else if (ticks() - xenogc.reset_ticks >
+				   msecs_to_ticks(DI_RESET_TIMEOUT_MSECS)) {
+				record_wait(DOLREL_WAIT_DI_RESET,
+					    xenogc.reset_ticks);
+				xenogc.state = XENOGC_DONE;
+				break;
+			}
+			di_start_debug_unlock(0);
+			xenogc.state = XENOGC_UNLOCK;
+			break;
+		}
+		if (xenogc.reset && !xenogc.found)
+			record_wait(DOLREL_WAIT_DI_RESET, xenogc.reset_ticks);
+
+		/* polls read on even if the unlock failed */
+		di_start_fw_read_meml(xenogc.found ? FW_XENOGC_RESET :
+						     FW_XENOGC_ID);
+		xenogc.state = XENOGC_READ;
+		break;
+	case XENOGC_READ:
+		word = result ? 1 : readl(io_base + DI_DATA);
+		if (!xenogc.found) {
+			if (word != XENOGC_ID) {
+				xenogc.state = XENOGC_DONE;
+				break;
 			}
+			di_start_disable_xenogc();
+			xenogc.found = 1;
+			xenogc.state = XENOGC_DISABLE;
+			rumble(1);
+			break;
 		}
+
+		/* the drive hands it over little endian */
+		le32_to_cpus(&word);
+		if (!(word & 0xffff) || ticks() - xenogc.start_ticks >=
+					msecs_to_ticks(XENOGC_TIMEOUT_MSECS)) {
+			record_wait(DOLREL_WAIT_XENOGC, xenogc.start_ticks);
+			rumble(0);
+			xenogc.state = XENOGC_DONE;
+			break;
+		}
+		xenogc.state = XENOGC_BUSY;
+		break;
+	case XENOGC_DISABLE:
+		xenogc.start_ticks = ticks();
+		xenogc.poll_ticks = xenogc.start_ticks -
+				    msecs_to_ticks(XENOGC_POLL_MSECS);
+		xenogc.state = XENOGC_BUSY;
+		/* fall through */
+	case XENOGC_BUSY:
+		if (ticks() - xenogc.start_ticks <
+		    msecs_to_ticks(xenogc.grace_msecs) ||
+		    ticks() - xenogc.poll_ticks <
+		    msecs_to_ticks(XENOGC_POLL_MSECS))
+			break;
+		xenogc.poll_ticks = ticks();
+		di_start_debug_unlock(0);
+		xenogc.state = XENOGC_UNLOCK;
+		break;
 	}
+
+	return xenogc.state == XENOGC_DONE;
 }
 
+/* features not built into this variant are compiled out */
+#define sdre_flag(dc, flag)	((SDRE_FLAGS & (flag)) && ((dc)->flags & (flag)))
+
+/*
+ * Copies a section through the locked cache dma engine, leaving to the
+ * core only what isn't made of whole cache lines.
+ */
+static void lc_dma_copy_sync(void *dst, void *src, unsigned long len)
+{
+	unsigned long lines = 0;
+
+	if (!((unsigned long)dst & (L1_CACHE_LINE_SIZE - 1)) &&
+	    !((unsigned long)src & (L1_CACHE_LINE_SIZE - 1)) &&
+	    (src >= dst + len || src + len <= dst)) {
+		lines = len & ~(L1_CACHE_LINE_SIZE - 1);
+
+		/* the dma engine works on memory, not on the cache */
+		flush_dcache_range(src, src + lines);
+		invalidate_dcache_range(dst, dst + lines);
+		lc_dma_copy(dst, src, lines);
+		invalidate_icache_range(dst, dst + lines);
+	}
+
+	if (lines < len)
+		copy_sync_range(dst + lines, src + lines, len - lines);
+}
 
 /*
  * Ditto.
@@ -350,52 +554,119 @@ static void sdre_disable_xenogc(void)
 static void relocate_sections(struct dolrel_control *dc)
 {
 	struct dolrel_section *section = (struct dolrel_section *)(dc + 1);
-	void *src_address = dc->src_address;
 	uint32_t nr_sections = dc->nr_sections;
+	void *dst_address, *src_address;
+	uint32_t timed = 0, bytes = 0;
+	struct lc_dma_state lc_state;
+	int lc_dma = 0;
+
+	if (sdre_flag(dc, DOLREL_FLAG_LC_DMA) && lc_dma_available()) {
+		lc_dma_enable(&lc_state);
+		lc_dma = 1;
+	}
 
 	while (nr_sections > 0) {
-		memcpy(section->dst_address, src_address, section->length);
-		flush_dcache_range(section->dst_address,
-				   section->dst_address + section->length);
-		invalidate_icache_range(section->dst_address,
-					section->dst_address + section->length);
+		dst_address = (void *)(uintptr_t)section->dst_address;
+		src_address = (void *)(uintptr_t)section->src_address;
+
+		/* udolrel already ordered the entries to handle overlaps */
+		if (section->flags & DOLREL_SECT_FILL)
+			memset(dst_address, 0, section->length);
+		else if (sdre_flag(dc, DOLREL_FLAG_LZ) &&
+			 (section->flags & DOLREL_SECT_LZ))
+			unlz(dst_address, src_address, section->src_length);
+		else if (section->flags & DOLREL_SECT_BACKWARD)
+			memmove(dst_address, src_address, section->length);
+		else if (section->flags & DOLREL_SECT_SCRATCH)
+			memcpy(dst_address, src_address, section->length);
+		else if (lc_dma)
+			lc_dma_copy_sync(dst_address, src_address,
+					 section->length);
+		else
+			/* copy and cache maintenance in a single pass */
+			copy_sync_range(dst_address, src_address,
+					section->length);
+
+		if (section->flags & (DOLREL_SECT_FILL | DOLREL_SECT_LZ |
+				      DOLREL_SECT_BACKWARD)) {
+			flush_dcache_range(dst_address,
+					   dst_address + section->length);
+			invalidate_icache_range(dst_address,
+						dst_address + section->length);
+		}
+
+		/* keep the drive going meanwhile */
+		if (sdre_flag(dc, DOLREL_FLAG_DISABLE_XENOGC))
+			sdre_xenogc_step();
+
+		if (timed < DOLREL_TIMING_SECTIONS)
+			timing->section_stamps[timed] = ticks();
+		timed++;
+		bytes += section->length;
 
-		src_address += section->length;
 		nr_sections--;
 
 		section++;
 	}
+	timing->nr_sections = timed;
+	timing->nr_bytes = bytes;
+
+	if (lc_dma)
+		lc_dma_disable(&lc_state);
 }
 
-typedef void (*entry_point_t) (void);
+typedef void (*entry_point_t) (struct dolrel_control *);
 
 int main(void)
 {
 	struct dolrel_control *dc = &__dolrel_control;
 	entry_point_t f;
-	unsigned long val;
 
 	local_irq_disable();
 
-	if (dc->flags & (DOLREL_FLAG_STOP_MOTOR|DOLREL_FLAG_DISABLE_XENOGC))
+	memset(timing, 0, sizeof(*timing));
+	timing->magic = DOLREL_TIMING_MAGIC;
+	stamp(DOLREL_STAMP_ENTRY);
+
+	if (sdre_flag(dc, DOLREL_FLAG_STOP_MOTOR|DOLREL_FLAG_DISABLE_XENOGC))
 		di_quiesce();
+	stamp(DOLREL_STAMP_QUIESCE);
 
-	if (dc->flags & DOLREL_FLAG_STOP_MOTOR)
+	/*
+	 * Get the drive going, and let it work on its own while we relocate.
+	 * The xenogc is dealt with in between the relocation entries.
+	 */
+	if (sdre_flag(dc, DOLREL_FLAG_STOP_MOTOR))
 		di_stop_motor();
-
-	if (dc->flags & DOLREL_FLAG_DISABLE_XENOGC)
-		sdre_disable_xenogc();
+	if (sdre_flag(dc, DOLREL_FLAG_DISABLE_XENOGC))
+		sdre_xenogc_start(dc->xenogc_grace_msecs);
+	stamp(DOLREL_STAMP_MOTOR);
 
 	relocate_sections(dc);
+	stamp(DOLREL_STAMP_RELOCATE);
+
 	if (dc->size_bss) {
-		memset(dc->address_bss, 0, dc->size_bss);
-		flush_dcache_range(dc->address_bss,
-				   dc->address_bss + dc->size_bss);
+		void *bss = (void *)(uintptr_t)dc->address_bss;
+
+		memset(bss, 0, dc->size_bss);
+		flush_dcache_range(bss, bss + dc->size_bss);
 	}
+	stamp(DOLREL_STAMP_BSS);
+
+	/* leave the drive idle for the kernel */
+	if (sdre_flag(dc, DOLREL_FLAG_DISABLE_XENOGC))
+		while (!sdre_xenogc_step())
+			;
+	if (sdre_flag(dc, DOLREL_FLAG_STOP_MOTOR|DOLREL_FLAG_DISABLE_XENOGC))
+		di_wait_command();
+	stamp(DOLREL_STAMP_DRIVE);
 
-	f = (entry_point_t) dc->entry_point;
-	(*f) ();
+	/* make the stamps visible to RAM dumps too */
+	flush_dcache_range(timing, timing + 1);
+
+	/* let the kernel find the blobs */
+	f = (entry_point_t)(uintptr_t)dc->entry_point;
+	(*f) (dc);
 
 	return 0;
 }
-
@@ -0,0 +1,540 @@
+/*
+ * dimodel.c
+ *
+ * MMIO shim, timebase and DVD drive model for sdresim.
+ * This program is part of the cubeboot-tools package.
+ *
+ * Copyright (C) 2005-2006 The GameCube Linux Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+/*
+ * Only what the relocation engine uses is modelled: the DI registers for
+ * polled immediate commands, the flipper reset register for drive resets,
+ * and enough of the drive firmware to tell whether a xenogc is there.
+ *
+ * On the cpu side, the Gekko locked cache and its dma engine are modelled
+ * too (HID2, DMAU, DMAL and DBAT3), so the real ppc/common/lcdma.c runs.
+ * Commands complete in order, each after a delay, and only move their
+ * data once complete, so a copy that does not wait for the queue to
+ * drain leaves stale memory behind for --check to find.
+ *
+ * Unless the host clock is asked for, the timebase is virtual and only
+ * moves when it is read or when a register is accessed, so runs are
+ * repeatable and long waits take no real time.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "../include/lib.h"
+
+#include "../include/dolrel.h"
+#include "../ppc/include/lcdma.h"
+
+#include "sdresim.h"
+
+/* virtual ticks taken by a register access */
+#define MMIO_TICKS		4
+
+#define DI_BASE			0xcc006000
+#define DI_SIZE			0x40
+
+#define DI_SR			0x00
+#define  DI_SR_BRK		(1<<0)
+#define  DI_SR_DEINTMASK	(1<<1)
+#define  DI_SR_DEINT		(1<<2)
+#define  DI_SR_TCINTMASK	(1<<3)
+#define  DI_SR_TCINT		(1<<4)
+#define  DI_SR_BRKINTMASK	(1<<5)
+#define  DI_SR_BRKINT		(1<<6)
+#define DI_CVR			0x04
+#define  DI_CVR_CVRINTMASK	(1<<1)
+#define  DI_CVR_CVRINT		(1<<2)
+#define DI_CMDBUF0		0x08
+#define DI_CMDBUF1		0x0c
+#define DI_CMDBUF2		0x10
+#define DI_MAR			0x14
+#define DI_LENGTH		0x18
+#define DI_CR			0x1c
+#define  DI_CR_TSTART		(1<<0)
+#define DI_DATA			0x20
+#define DI_CFG			0x24
+
+#define DI_SR_INTS		(DI_SR_DEINT | DI_SR_TCINT | DI_SR_BRKINT)
+#define DI_SR_MASKS		(DI_SR_DEINTMASK | DI_SR_TCINTMASK | \
+				 DI_SR_BRKINTMASK)
+
+#define FLIPPER_RESET		0xcc003024
+#define  FLIPPER_RESET_DVD	0x00000004
+
+/* serial interface, only written to for rumbling */
+#define SI_BASE			0xcc006400
+#define SI_SIZE			0x100
+#define SI_C0OUTBUF		0x00
+
+/* drive firmware addresses peeked at by the stub */
+#define FW_XENOGC_ID		0x40c60a
+#define FW_XENOGC_RESET		0x40d100
+#define XENOGC_ID		0xf710fff7
+
+/* virtual ticks taken by a special purpose register access */
+#define SPR_TICKS		1
+
+#define SPRN_PVR		287
+#define SPRN_HID2		920
+#define SPRN_DMAU		922
+#define SPRN_DMAL		923
+#define SPRN_DBAT3U		542
+#define SPRN_DBAT3L		543
+
+#define PVR_GEKKO		0x00083214
+#define PVR_750			0x00080200
+
+#define HID2_LCE		(1<<28)
+#define HID2_DMAQL_SHIFT	24
+#define HID2_DMAQL		(0xf << HID2_DMAQL_SHIFT)
+
+#define DMAU_MEM		0x0fffffe0
+#define DMAU_LEN_U		0x1f
+#define DMAL_LC			0xffffffe0
+#define DMAL_LD			(1<<4)
+#define DMAL_LEN_L(dmal)	(((dmal) >> 2) & 3)
+#define DMAL_T			(1<<1)
+#define DMAL_F			(1<<0)
+
+#define DMA_QUEUE_MAX		15
+
+/* a command costs some setup, then streams lines at half the bus rate */
+#define LC_DMA_SETUP_TICKS	8
+#define LC_DMA_LINE_TICKS	2
+
+#define LC_LINE_SIZE		32
+
+struct di_script di_script = {
+	.command_ticks	= usecs_to_ticks(100),
+	.motor_ticks	= usecs_to_ticks(20000),
+	.reset_ticks	= usecs_to_ticks(500000),
+};
+
+struct di_stats di_stats;
+
+int real_timebase;
+
+unsigned long host_msr;
+
+static unsigned long now;
+static struct timespec start_time;
+
+static struct {
+	uint32_t sr, cvr, cr, cfg;
+	uint32_t cmdbuf[3];
+	uint32_t mar, length, data;
+	uint32_t reset;
+
+	unsigned long done_at;		/* when the running command ends */
+	uint32_t result;		/* and what it returns */
+	int error;
+
+	int debug;			/* debug commands unlocked */
+	unsigned long ready_at;		/* back from reset */
+	unsigned long xenogc_done_at;
+} di = {
+	.reset = FLIPPER_RESET_DVD | 1,
+};
+
+struct lc_dma_stats lc_dma_stats;
+
+int lc_dma_present;
+
+struct lc_dma_command {
+	uint32_t mem;			/* physical */
+	uint32_t lc;
+	unsigned long len;
+	int load;			/* memory to locked cache */
+	unsigned long done_at;
+};
+
+static struct {
+	unsigned long hid2;
+	unsigned long dmau;
+	unsigned long dbat3u, dbat3l;
+
+	struct lc_dma_command queue[DMA_QUEUE_MAX];
+	int head, count;
+	unsigned long busy_until;	/* when the last queued command ends */
+
+	uint8_t buf[LC_SIZE];
+} lc;
+
+/**
+ *
+ */
+void timebase_start(void)
+{
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
+	now = 0;
+}
+
+/**
+ * Current timebase, without moving it.
+ */
+static unsigned long timebase(void)
+{
+	struct timespec ts;
+	unsigned long long nsecs;
+
+	if (!real_timebase)
+		return now;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	nsecs = (ts.tv_sec - start_time.tv_sec) * 1000000000ULL +
+		ts.tv_nsec - start_time.tv_nsec;
+	return (unsigned long)(nsecs * TB_TICKS_PER_USEC / 1000);
+}
+
+/**
+ *
+ */
+unsigned long ticks(void)
+{
+	return real_timebase ? timebase() : now++;
+}
+
+/**
+ * Decides what a command does, and how long it takes.
+ */
+static void di_start_command(void)
+{
+	uint32_t cmd = di.cmdbuf[0];
+	unsigned long latency = di_script.command_ticks;
+
+	di_stats.nr_commands++;
+	di.error = 0;
+	di.result = 0;
+
+	if (!(di.reset & FLIPPER_RESET_DVD) || timebase() < di.ready_at) {
+		/* not back from reset yet */
+		di.error = 1;
+	} else if (cmd >> 24 == 0xe3) {
+		/* stop motor */
+		latency = di_script.motor_ticks;
+	} else if (cmd >> 24 == 0xff) {
+		/* the two halves of the debug unlock */
+		if (di_script.debug_errors > 0) {
+			di_script.debug_errors--;
+			di.error = 1;
+		} else if ((cmd & 0x00ff0000) == 0) {
+			di.debug = 1;
+		}
+	} else if (cmd == 0xfe010000 && di.debug) {
+		/* read drive memory, comes back little endian */
+		if (di.cmdbuf[1] == FW_XENOGC_ID)
+			di.result = di_script.xenogc ? XENOGC_ID : 0;
+		else if (di.cmdbuf[1] == FW_XENOGC_RESET)
+			di.result = (di_stats.xenogc_disabled &&
+				     timebase() < di.xenogc_done_at) ?
+				    0x01000000 : 0;
+	} else if (cmd >> 24 == 0x25 && di_script.xenogc) {
+		di_stats.xenogc_disabled = 1;
+		di.xenogc_done_at = timebase() + latency +
+				    di_script.xenogc_ticks;
+	} else {
+		di.error = 1;
+	}
+
+	if (di.error)
+		di_stats.nr_errors++;
+	di.done_at = timebase() + latency;
+	di.cr |= DI_CR_TSTART;
+}
+
+/**
+ * Completes the running command once its time has come.
+ */
+static void di_update(void)
+{
+	if (!(di.cr & DI_CR_TSTART) || timebase() < di.done_at)
+		return;
+
+	di.cr &= ~DI_CR_TSTART;
+	di.data = di.result;
+	di.sr |= di.error ? DI_SR_DEINT : DI_SR_TCINT;
+}
+
+/**
+ *
+ */
+static void flipper_reset(uint32_t val)
+{
+	/* the drive comes back some time after leaving reset */
+	if ((di.reset & FLIPPER_RESET_DVD) && !(val & FLIPPER_RESET_DVD)) {
+		di_stats.nr_resets++;
+		di.cr &= ~DI_CR_TSTART;
+		di.debug = 0;
+		di_script.debug_errors = 0;
+	} else if (!(di.reset & FLIPPER_RESET_DVD) &&
+		   (val & FLIPPER_RESET_DVD)) {
+		di.ready_at = timebase() + di_script.reset_ticks;
+	}
+	di.reset = val;
+}
+
+/**
+ * Moves the data of the queued commands whose time has come.
+ */
+static void lc_dma_update(void)
+{
+	struct lc_dma_command *cmd;
+	uint8_t *mem, *buf;
+
+	while (lc.count > 0 && timebase() >= lc.queue[lc.head].done_at) {
+		cmd = &lc.queue[lc.head];
+		mem = (uint8_t *)(uintptr_t)(0x80000000 | cmd->mem);
+		buf = lc.buf + (cmd->lc - LC_BASE);
+		if (cmd->load) {
+			memcpy(buf, mem, cmd->len);
+		} else {
+			memcpy(mem, buf, cmd->len);
+			lc_dma_stats.nr_bytes += cmd->len;
+		}
+		lc.head = (lc.head + 1) % DMA_QUEUE_MAX;
+		lc.count--;
+	}
+}
+
+/**
+ * Checks that the locked cache is there and mapped where it is used.
+ */
+static void lc_check_mapped(const char *what, unsigned long address,
+			    unsigned long len)
+{
+	if (!(lc.hid2 & HID2_LCE))
+		die("%s with the locked cache disabled\n", what);
+	if ((lc.dbat3u & 0xfffe0000) != LC_BASE || !(lc.dbat3u & 2))
+		die("%s with the locked cache not mapped\n", what);
+	if (address < LC_BASE || address - LC_BASE > LC_SIZE - len)
+		die("%s outside the locked cache at 0x%08lx\n", what, address);
+}
+
+/**
+ * Queues the command described by DMAU and the DMAL just written.
+ */
+static void lc_dma_start_command(unsigned long dmal)
+{
+	struct lc_dma_command *cmd;
+	unsigned long lines, start;
+
+	lc_dma_update();
+	if (lc.count == DMA_QUEUE_MAX)
+		die("locked cache dma queue overflow\n");
+
+	lines = ((lc.dmau & DMAU_LEN_U) << 2) | DMAL_LEN_L(dmal);
+	if (!lines)
+		lines = LC_DMA_MAX_BLOCKS;
+
+	cmd = &lc.queue[(lc.head + lc.count) % DMA_QUEUE_MAX];
+	cmd->mem = lc.dmau & DMAU_MEM;
+	cmd->lc = dmal & DMAL_LC;
+	cmd->len = lines * LC_LINE_SIZE;
+	cmd->load = !!(dmal & DMAL_LD);
+
+	lc_check_mapped("locked cache dma", cmd->lc, cmd->len);
+	if (0x80000000 + cmd->mem > DOLREL_MEM_END - cmd->len)
+		die("locked cache dma beyond memory at 0x%08x\n", cmd->mem);
+
+	/* commands run one after the other */
+	start = timebase();
+	if (start < lc.busy_until)
+		start = lc.busy_until;
+	cmd->done_at = start + LC_DMA_SETUP_TICKS + lines * LC_DMA_LINE_TICKS;
+	lc.busy_until = cmd->done_at;
+	lc.count++;
+
+	lc_dma_stats.nr_commands++;
+}
+
+/**
+ *
+ */
+unsigned long mfspr(int rn)
+{
+	if (!real_timebase)
+		now += SPR_TICKS;
+
+	switch (rn) {
+		case SPRN_PVR:
+			return lc_dma_present ? PVR_GEKKO : PVR_750;
+		case SPRN_HID2:
+			lc_dma_update();
+			return (lc.hid2 & ~HID2_DMAQL) |
+			       (lc.count << HID2_DMAQL_SHIFT);
+		case SPRN_DBAT3U:
+			return lc.dbat3u;
+		case SPRN_DBAT3L:
+			return lc.dbat3l;
+	}
+	die("read from unmodelled spr %d\n", rn);
+	return 0;
+}
+
+/**
+ *
+ */
+void mtspr(int rn, unsigned long v)
+{
+	if (!real_timebase)
+		now += SPR_TICKS;
+
+	switch (rn) {
+		case SPRN_HID2:
+			if (!lc_dma_present && (v & HID2_LCE))
+				die("locked cache enabled on a cpu without"
+				    " one\n");
+			lc_dma_update();
+			if ((lc.hid2 & HID2_LCE) && !(v & HID2_LCE) &&
+			    lc.count)
+				die("locked cache disabled with %d dma"
+				    " commands queued\n", lc.count);
+			lc.hid2 = v & ~HID2_DMAQL;
+			return;
+		case SPRN_DMAU:
+			lc.dmau = v;
+			return;
+		case SPRN_DMAL:
+			if (v & DMAL_F)
+				die("locked cache dma flush not modelled\n");
+			if (v & DMAL_T)
+				lc_dma_start_command(v);
+			return;
+		case SPRN_DBAT3U:
+			lc.dbat3u = v;
+			return;
+		case SPRN_DBAT3L:
+			lc.dbat3l = v;
+			return;
+	}
+	die("write to unmodelled spr %d\n", rn);
+}
+
+/**
+ *
+ */
+void dcbz_l(unsigned long address)
+{
+	lc_check_mapped("dcbz_l", address, LC_LINE_SIZE);
+	memset(lc.buf + ((address - LC_BASE) & ~(LC_LINE_SIZE - 1)), 0,
+	       LC_LINE_SIZE);
+}
+
+/**
+ * Only ever used to give locked cache lines back.
+ */
+void dcbi(unsigned long address)
+{
+	lc_check_mapped("dcbi", address, LC_LINE_SIZE);
+}
+
+/**
+ *
+ */
+unsigned long readl(volatile void *addr)
+{
+	unsigned long address = (unsigned long)addr;
+
+	if (!real_timebase)
+		now += MMIO_TICKS;
+
+	if (address == FLIPPER_RESET)
+		return di.reset;
+	if (address < DI_BASE || address >= DI_BASE + DI_SIZE)
+		die("read from unmodelled register 0x%08lx\n", address);
+
+	di_update();
+	switch (address - DI_BASE) {
+		case DI_SR:
+			return di.sr;
+		case DI_CVR:
+			return di.cvr;
+		case DI_CMDBUF0:
+		case DI_CMDBUF1:
+		case DI_CMDBUF2:
+			return di.cmdbuf[(address - DI_BASE - DI_CMDBUF0) / 4];
+		case DI_MAR:
+			return di.mar;
+		case DI_LENGTH:
+			return di.length;
+		case DI_CR:
+			return di.cr;
+		case DI_DATA:
+			return di.data;
+		case DI_CFG:
+			return di.cfg;
+	}
+	die("read from unmodelled register 0x%08lx\n", address);
+	return 0;
+}
+
+/**
+ *
+ */
+void writel(unsigned long b, volatile void *addr)
+{
+	unsigned long address = (unsigned long)addr;
+	uint32_t val = b;
+
+	if (!real_timebase)
+		now += MMIO_TICKS;
+
+	if (address == FLIPPER_RESET) {
+		flipper_reset(val);
+		return;
+	}
+	if (address >= SI_BASE && address < SI_BASE + SI_SIZE) {
+		if (address == SI_BASE + SI_C0OUTBUF)
+			di_stats.rumbling = val & 1;
+		return;
+	}
+	if (address < DI_BASE || address >= DI_BASE + DI_SIZE)
+		die("write to unmodelled register 0x%08lx\n", address);
+
+	di_update();
+	switch (address - DI_BASE) {
+		case DI_SR:
+			/* interrupt bits are cleared by writing ones */
+			di.sr = (di.sr & DI_SR_INTS & ~val) |
+				(val & (DI_SR_MASKS | DI_SR_BRK));
+			return;
+		case DI_CVR:
+			di.cvr = (di.cvr & DI_CVR_CVRINT & ~val) |
+				 (val & DI_CVR_CVRINTMASK);
+			return;
+		case DI_CMDBUF0:
+		case DI_CMDBUF1:
+		case DI_CMDBUF2:
+			di.cmdbuf[(address - DI_BASE - DI_CMDBUF0) / 4] = val;
+			return;
+		case DI_MAR:
+			di.mar = val;
+			return;
+		case DI_LENGTH:
+			di.length = val;
+			return;
+		case DI_CR:
+			di.cr = val & ~DI_CR_TSTART;
+			if (val & DI_CR_TSTART)
+				di_start_command();
+			return;
+		case DI_CFG:
+			return;
+	}
+	die("write to unmodelled register 0x%08lx\n", address);
+}
@@ -0,0 +1,493 @@
+/*
+ * sdresim.c
+ *
+ * Runs the relocation engine of a relocated .dol on the host.
+ * This program is part of the cubeboot-tools package.
+ *
+ * Copyright (C) 2005-2006 The GameCube Linux Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+/*
+ * sdre.c is built for the host with SDRE_HOST defined, which routes its
+ * register accesses and timebase reads to dimodel.c. The .dol produced by
+ * udolrel is loaded into memory mapped at the usual GameCube addresses,
+ * its control header and relocation table are converted to host order,
+ * and the entry point is pointed back at us, so we get control again
+ * once the stub is done.
+ *
+ * The stub's own mem* and copy_sync_range() from ppc/common/lib.c are
+ * linked in too, in place of the C library ones, and so is the locked
+ * cache dma code from ppc/common/lcdma.c, so --check covers them.
+ * Only the cache maintenance instructions are left out.
+ *
+ * This allows trying the relocation and the drive handling against
+ * scripted drive behaviours, and timing them with the host clock.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "../include/lib.h"
+
+#include "../include/dol.h"
+#include "../include/dolrel.h"
+#include "../ppc/include/lcdma.h"
+
+#include "sdresim.h"
+
+#define _GNU_SOURCE
+#include <getopt.h>
+
+#define SDRESIM_VERSION "V0.1-20261018"
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE	0x100000
+#endif
+
+/* all of main memory, where the stub expects it */
+#define MEM_START		0x80000000
+#define MEM_SIZE		(DOLREL_MEM_END - MEM_START)
+
+/* memory starts out dirty, so a missed bss clear shows */
+#define MEM_JUNK		0x5a
+
+const char *__progname;
+
+/* the control header sdre.c works on */
+struct dolrel_control *sdre_host_control;
+
+extern int sdre_main(void);
+
+static char *check_file;
+static char *outfile;
+static uint32_t entry_point;
+
+#define SIM_CACHE_LINE_SIZE	32
+#define SIM_CACHE_LINE_WORDS	(SIM_CACHE_LINE_SIZE / sizeof(uint32_t))
+
+/*
+ * The cache maintenance has nothing to do on the host, memory is all
+ * there is. The locked cache is modelled in dimodel.c.
+ */
+void flush_dcache_range(void *start, void *stop)
+{
+	(void)start; (void)stop;
+}
+
+void invalidate_dcache_range(void *start, void *stop)
+{
+	(void)start; (void)stop;
+}
+
+void invalidate_icache_range(void *start, void *stop)
+{
+	(void)start; (void)stop;
+}
+
+void flush_dcache_all(void)
+{
+}
+
+/*
+ * Same order of accesses as the misc.S version: each destination line is
+ * claimed with dcbz before its source words are loaded, so a source
+ * running into the destination shows up as zeroes.
+ */
+void copy_sync_lines(void *dst, const void *src, unsigned long len)
+{
+	uint32_t *d = dst;
+	const uint32_t *s = src;
+	unsigned long lines = len / SIM_CACHE_LINE_SIZE;
+	unsigned int i;
+
+	while (lines--) {
+		for (i = 0; i < SIM_CACHE_LINE_WORDS; i++)
+			d[i] = 0;
+		for (i = 0; i < SIM_CACHE_LINE_WORDS; i++)
+			*d++ = *s++;
+	}
+}
+
+/*
+ * The stub would rumble and spin forever, that is of no use here.
+ */
+void panic(char *text)
+{
+	die("panic: %s\n", text);
+}
+
+/**
+ *
+ */
+static int in_memory(uint32_t address, uint32_t size)
+{
+	return address >= MEM_START && address < DOLREL_MEM_END &&
+	       size <= DOLREL_MEM_END - address;
+}
+
+/**
+ *
+ */
+void map_memory(void)
+{
+	void *mem;
+
+	mem = mmap((void *)MEM_START, MEM_SIZE, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+	if (mem != (void *)MEM_START)
+		die("Cannot map memory at 0x%08x: %s\n", MEM_START,
+		    strerror(errno));
+	memset(mem, MEM_JUNK, MEM_SIZE);
+}
+
+/**
+ * Loads the sections of a relocated .dol where the apploader would.
+ */
+void load_dol(uint8_t *image, off_t size, const char *filename)
+{
+	struct dol_header *dol = (struct dol_header *)image;
+	uint32_t offset, address, length;
+	int k;
+
+	if (size < (off_t)sizeof(*dol))
+		die("%s: can't read dol header: input too short\n", filename);
+
+	for (k = 0; k < DOL_MAX_SECT; k++) {
+		offset = be32_to_cpu(dol_sect_offset(dol, k));
+		address = be32_to_cpu(dol_sect_address(dol, k));
+		length = be32_to_cpu(dol_sect_size(dol, k));
+		if (!length)
+			continue;
+		if (offset > size || length > size - offset)
+			die("%s: section %d is past the end of the input\n",
+			    filename, k);
+		if (!in_memory(address, length))
+			die("%s: section %d doesn't fit in memory\n",
+			    filename, k);
+		memcpy((void *)(unsigned long)address, image + offset, length);
+	}
+}
+
+/**
+ * Finds the control header after the stub, and makes it host order.
+ */
+struct dolrel_control *setup_control(uint8_t *image, const char *filename)
+{
+	struct dol_header *dol = (struct dol_header *)image;
+	struct dolrel_control *dc = NULL;
+	uint32_t base, size, offset, nr_sections;
+	uint32_t *p;
+
+	/* text[1] holds the stub, its control header and the table */
+	base = be32_to_cpu(dol->address_text[1]);
+	size = be32_to_cpu(dol->size_text[1]);
+	if (base != DOLREL_STUB_ADDRESS || !size)
+		die("%s: not relocated by udolrel\n", filename);
+
+	for (offset = 0; offset + sizeof(*dc) <= size; offset += 4) {
+		p = (uint32_t *)(unsigned long)(base + offset);
+		if (be32_to_cpu(p[0]) != DOLREL_VERSION)
+			continue;
+		dc = (struct dolrel_control *)p;
+		nr_sections = be32_to_cpu(dc->nr_sections);
+		if (nr_sections <= (size - offset - sizeof(*dc)) /
+				   sizeof(struct dolrel_section))
+			break;
+		dc = NULL;
+	}
+	if (!dc)
+		die("%s: no control header for version 0x%08x\n",
+		    filename, DOLREL_VERSION);
+
+	p = (uint32_t *)dc;
+	be32_to_cpu_array(p, p, (sizeof(*dc) + nr_sections *
+				 sizeof(struct dolrel_section)) / 4);
+	return dc;
+}
+
+/**
+ * Checks that memory holds what the original .dol would have loaded.
+ */
+int check_memory(const char *filename)
+{
+	struct dol_header *dol;
+	uint32_t offset, address, length, i;
+	uint8_t *image, *bss;
+	off_t size;
+	int k, problems = 0;
+
+	image = (uint8_t *)slurp_file(filename, &size);
+	if (size < (off_t)sizeof(*dol))
+		die("%s: can't read dol header: input too short\n", filename);
+	dol = (struct dol_header *)image;
+
+	for (k = 0; k < DOL_MAX_SECT; k++) {
+		offset = be32_to_cpu(dol_sect_offset(dol, k));
+		address = be32_to_cpu(dol_sect_address(dol, k));
+		length = be32_to_cpu(dol_sect_size(dol, k));
+		if (!length)
+			continue;
+		if (offset > size || length > size - offset ||
+		    !in_memory(address, length))
+			die("%s: bad section %d\n", filename, k);
+		if (memcmp((void *)(unsigned long)address, image + offset,
+			   length)) {
+			fprintf(stderr, "%s: section %d at 0x%08x differs\n",
+				filename, k, address);
+			problems++;
+		}
+	}
+
+	address = be32_to_cpu(dol->address_bss);
+	length = be32_to_cpu(dol->size_bss);
+	if (length && !in_memory(address, length))
+		die("%s: bad bss\n", filename);
+	bss = (uint8_t *)(unsigned long)address;
+	for (i = 0; i < length; i++) {
+		if (bss[i]) {
+			fprintf(stderr, "%s: bss not clear at 0x%08x\n",
+				filename, address + i);
+			problems++;
+			break;
+		}
+	}
+
+	free(image);
+	return problems;
+}
+
+/**
+ * Dumps main memory, with the timing records as the target leaves them.
+ */
+void dump_memory(const char *filename)
+{
+	uint32_t *timing = (uint32_t *)DOLREL_TIMING_ADDRESS;
+	ssize_t result;
+	unsigned int i;
+	int fd;
+
+	for (i = 0; i < sizeof(struct dolrel_timing) / 4; i++)
+		timing[i] = cpu_to_be32(timing[i]);
+
+	fd = open(filename, O_CREAT | O_TRUNC | O_WRONLY, 0666);
+	if (fd < 0)
+		die("Cannot open `%s': %s\n", filename, strerror(errno));
+	result = write(fd, (void *)MEM_START, MEM_SIZE);
+	if (result != MEM_SIZE)
+		die("Write of %s failed\n", filename);
+	close(fd);
+}
+
+/**
+ *
+ */
+static void print_wait(const char *name, uint32_t ticks)
+{
+	printf("%-20s %10u ticks %12.1f us\n", name, ticks,
+	       ticks / TB_TICKS_PER_USEC);
+}
+
+/**
+ * The stub jumps here instead of to the relocated program.
+ */
+void sim_entry(struct dolrel_control *dc)
+{
+	struct dolrel_timing *timing =
+		(struct dolrel_timing *)DOLREL_TIMING_ADDRESS;
+	uint32_t relocation;
+	int problems = 0;
+
+	relocation = timing->stamps[DOLREL_STAMP_RELOCATE] -
+		     timing->stamps[DOLREL_STAMP_MOTOR];
+
+	printf("%-20s 0x%08x\n", "entry point", entry_point);
+	printf("%-20s 0x%x\n", "run flags", dc->flags);
+	printf("%-20s %lu (%lu failed, %lu resets)\n", "drive commands",
+	       di_stats.nr_commands, di_stats.nr_errors, di_stats.nr_resets);
+	printf("%-20s %s\n", "xenogc disabled",
+	       di_stats.xenogc_disabled ? "yes" : "no");
+	printf("%-20s %s\n", "rumble", di_stats.rumbling ? "on" : "off");
+	printf("%-20s %lu bytes (%lu commands)\n", "locked cache dma",
+	       lc_dma_stats.nr_bytes, lc_dma_stats.nr_commands);
+	print_wait("wait di reset", dc->wait_ticks[DOLREL_WAIT_DI_RESET]);
+	print_wait("wait di command", dc->wait_ticks[DOLREL_WAIT_DI_COMMAND]);
+	print_wait("wait xenogc", dc->wait_ticks[DOLREL_WAIT_XENOGC]);
+	print_wait("relocation", relocation);
+	printf("%-20s %u bytes\n", "relocated", timing->nr_bytes);
+
+	if (check_file)
+		problems = check_memory(check_file);
+	if (outfile)
+		dump_memory(outfile);
+
+	exit(problems ? 1 : 0);
+}
+
+/**
+ *
+ */
+void version(void)
+{
+	printf("version %s\n", SDRESIM_VERSION);
+	exit(2);
+}
+
+/**
+ *
+ */
+void usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [OPTION] [FILE]" "\n"
+		"  -F, --flags=N           run flags (default from FILE)" "\n"
+		"  -u, --command-usecs=N   drive command latency" "\n"
+		"  -m, --motor-usecs=N     motor stop latency" "\n"
+		"  -r, --reset-usecs=N     drive recovery after a reset" "\n"
+		"  -e, --debug-errors=N    debug commands fail N times," "\n"
+		"                          until the drive is reset" "\n"
+		"  -x, --xenogc=MSECS      a xenogc is present, and busy for"
+					" MSECS" "\n"
+		"                          after being disabled" "\n"
+		"  -l, --lc-dma            the cpu is a Gekko, with the locked"
+					" cache" "\n"
+		"  -T, --real-timebase     timebase follows the host clock" "\n"
+		"  -c, --check=DOL         check memory against the"
+					" original DOL" "\n"
+		"  -o, --outfile=PATH      dump memory to PATH at the end" "\n"
+		, __progname);
+	exit(1);
+}
+
+/**
+ *
+ */
+static unsigned long parse_number(const char *arg)
+{
+	unsigned long val;
+	char *end;
+
+	val = strtoul(arg, &end, 0);
+	if (!*arg || *end)
+		die("bad number %s\n", arg);
+	return val;
+}
+
+/**
+ *
+ */
+int main(int argc, char *argv[])
+{
+	struct dolrel_control *dc;
+	long run_flags = -1;
+	uint8_t *image;
+	char *infile, *p;
+	off_t size;
+	int ch;
+
+	struct option long_options[] = {
+		{"flags", 1, NULL, 'F'},
+		{"command-usecs", 1, NULL, 'u'},
+		{"motor-usecs", 1, NULL, 'm'},
+		{"reset-usecs", 1, NULL, 'r'},
+		{"debug-errors", 1, NULL, 'e'},
+		{"xenogc", 1, NULL, 'x'},
+		{"lc-dma", 0, NULL, 'l'},
+		{"real-timebase", 0, NULL, 'T'},
+		{"check", 1, NULL, 'c'},
+		{"outfile", 1, NULL, 'o'},
+		{"version", 0, NULL, 'v'},
+		{"help", 0, NULL, 'h'},
+		{0,0,0,0}
+	};
+#define SHORT_OPTIONS "F:u:m:r:e:x:lTc:o:vh"
+
+	p = strrchr(argv[0], '/');
+	__progname = (p && p[1]) ? p+1 : argv[0];
+
+	while((ch = getopt_long(argc, argv, SHORT_OPTIONS,
+				long_options, NULL)) != -1) {
+		switch(ch) {
+			case 'F':
+				run_flags = parse_number(optarg);
+				break;
+			case 'u':
+				di_script.command_ticks =
+					usecs_to_ticks(parse_number(optarg));
+				break;
+			case 'm':
+				di_script.motor_ticks =
+					usecs_to_ticks(parse_number(optarg));
+				break;
+			case 'r':
+				di_script.reset_ticks =
+					usecs_to_ticks(parse_number(optarg));
+				break;
+			case 'e':
+				di_script.debug_errors = parse_number(optarg);
+				break;
+			case 'x':
+				di_script.xenogc = 1;
+				di_script.xenogc_ticks =
+				    usecs_to_ticks(parse_number(optarg) * 1000);
+				break;
+			case 'l':
+				lc_dma_present = 1;
+				break;
+			case 'T':
+				real_timebase = 1;
+				break;
+			case 'c':
+				check_file = optarg;
+				break;
+			case 'o':
+				outfile = optarg;
+				break;
+			case 'v':
+				version();
+				break;
+			case 'h':
+			case '?':
+			default:
+				usage();
+				break;
+		}
+	}
+
+	if (argc-optind != 1)
+		usage();
+	infile = argv[optind];
+
+	/* the stub gets back to us through a 32 bit entry point */
+	if ((unsigned long)sim_entry > 0xffffffffUL)
+		die("%s must be linked below 4GB\n", __progname);
+
+	map_memory();
+	image = (uint8_t *)slurp_file(infile, &size);
+	load_dol(image, size, infile);
+	dc = setup_control(image, infile);
+	free(image);
+
+	if (run_flags >= 0)
+		dc->flags = run_flags;
+	entry_point = dc->entry_point;
+	dc->entry_point = (uint32_t)(unsigned long)sim_entry;
+	sdre_host_control = dc;
+
+	timebase_start();
+	sdre_main();
+
+	die("the stub returned\n");
+	return 1;
+}
@@ -0,0 +1,63 @@
+/*
+ * sdresim.h
+ *
+ * Host side models for running the relocation engine on a PC.
+ * Copyright (C) 2005-2006 The GameCube Linux Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+#ifndef __SDRESIM_H
+#define __SDRESIM_H
+
+#include <stdint.h>
+
+/* the timebase runs at a quarter of the 162MHz bus clock */
+#define TB_TICKS_PER_USEC	40.5
+
+#define usecs_to_ticks(us)	((unsigned long)((us) * TB_TICKS_PER_USEC))
+
+/*
+ * How the drive behaves. All latencies are in timebase ticks.
+ */
+struct di_script {
+	unsigned long command_ticks;	/* any command */
+	unsigned long motor_ticks;	/* motor stop */
+	unsigned long reset_ticks;	/* until the drive is back from reset */
+	int debug_errors;		/* debug commands failing until reset */
+	int xenogc;			/* a drivechip is present */
+	unsigned long xenogc_ticks;	/* drivechip busy after disabling it */
+};
+
+/* what the drive went through */
+struct di_stats {
+	unsigned long nr_commands;
+	unsigned long nr_errors;
+	unsigned long nr_resets;
+	int xenogc_disabled;
+	int rumbling;			/* as left on the first pad */
+};
+
+/* what went through the locked cache dma engine */
+struct lc_dma_stats {
+	unsigned long nr_commands;
+	unsigned long nr_bytes;		/* stored back to memory */
+};
+
+extern struct di_script di_script;
+extern struct di_stats di_stats;
+extern struct lc_dma_stats lc_dma_stats;
+
+/* the cpu is a Gekko, with the locked cache */
+extern int lc_dma_present;
+
+/* the timebase follows the host clock instead of counting accesses */
+extern int real_timebase;
+
+extern void timebase_start(void);
+
+#endif /* __SDRESIM_H */
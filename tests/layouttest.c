@@ -0,0 +1,466 @@
+/*
+ * layouttest.c
+ *
+ * Checks that the apploader coalesces the reads of a DOL laid out by
+ * dollayout.
+ * This program is part of the cubeboot-tools package.
+ *
+ * Copyright (C) 2005-2006 The GameCube Linux Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+/*
+ * dollayout.c is built in with its main renamed. Random DOLs are laid
+ * out by relayout_dol(), then loaded into a copy of the RAM the way
+ * step 4 of al_load() in ppc/apploader/apploader.c does it, with the
+ * same dol_sect_follows() deciding which sections go in each read.
+ *
+ * Every section must end up in place, the bytes read between sections
+ * must not hit low memory nor the .bss, and there must be fewer reads
+ * than sections.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/lib.h"
+#include "../include/dol.h"
+#include "../include/gcm.h"
+
+#define _GNU_SOURCE
+#include <getopt.h>
+
+#define LAYOUTTEST_VERSION "V0.1-20261018"
+
+extern const char *__progname;
+
+#define RAM_START	0x80000000
+#define RAM_SIZE	(4*1024*1024)
+
+/* where sections end at most, leaving room for the .bss */
+#define RAM_LIMIT	(RAM_SIZE - 0x10000)
+
+/* what the IPL and the .bss hold while sections are loaded */
+#define POISON		0xa5
+
+#define DI_ALIGN_SIZE	32
+#define di_align(addr)	((((unsigned long)(addr)) + \
+				 DI_ALIGN_SIZE - 1) & ~(DI_ALIGN_SIZE - 1))
+
+extern unsigned int load_order(struct dol_header *dol, int *order);
+extern int check_dol(struct dol_header *dol, unsigned long dol_length,
+		     const char *name);
+extern int check_layout(struct dol_header *dol, unsigned long align,
+			const char *name);
+extern unsigned long relayout_dol(uint8_t **out, uint8_t *in,
+				  unsigned long align);
+
+static uint8_t *ram;
+static int problems;
+
+static unsigned long nr_dols, nr_sections, nr_reads;
+
+/**
+ * A random number in [0, n).
+ */
+static unsigned long rnd(unsigned long n)
+{
+	return (unsigned long)random() % n;
+}
+
+/**
+ * Sets a header field, the DOL is big endian.
+ */
+static void set_sect(struct dol_header *dol, int k, uint32_t offset,
+		     uint32_t address, uint32_t size)
+{
+	if (k < DOL_SECT_MAX_TEXT) {
+		dol->offset_text[k] = cpu_to_be32(offset);
+		dol->address_text[k] = cpu_to_be32(address);
+		dol->size_text[k] = cpu_to_be32(size);
+	} else {
+		k -= DOL_SECT_MAX_TEXT;
+		dol->offset_data[k] = cpu_to_be32(offset);
+		dol->address_data[k] = cpu_to_be32(address);
+		dol->size_data[k] = cpu_to_be32(size);
+	}
+}
+
+/**
+ * Gets the lowest pending section, as al_next_dol_sect() does.
+ */
+static int next_sect(struct dol_header *dol, uint32_t sects_bitmap,
+		     uint32_t all_sects_bitmap)
+{
+	unsigned long lowest_start = 0xffffffff;
+	int j = -1, k;
+
+	for (k = 0; k < DOL_MAX_SECT; k++) {
+		if ((sects_bitmap & (1 << k)) != 0)
+			continue;
+		if (!(all_sects_bitmap & (1 << k)))
+			continue;
+		if (be32_to_cpu(dol_sect_address(dol, k)) < lowest_start) {
+			lowest_start = be32_to_cpu(dol_sect_address(dol, k));
+			j = k;
+		}
+	}
+	return j;
+}
+
+/**
+ * Loads a DOL into the RAM copy in as few reads as the apploader does.
+ * Returns the number of reads.
+ */
+static unsigned int load_dol(uint8_t *image, unsigned long size)
+{
+	struct dol_header *dol = (struct dol_header *)image;
+	uint32_t sects_bitmap = 0, all_sects_bitmap = 0;
+	unsigned long start, end, disk_start, disk_end;
+	unsigned int reads = 0, nr_sects, i;
+	int order[DOL_MAX_SECT];
+	int j, k;
+
+	nr_sects = load_order(dol, order);
+	for (i = 0; i < nr_sects; i++)
+		all_sects_bitmap |= (1 << order[i]);
+
+	while (sects_bitmap != all_sects_bitmap) {
+		j = next_sect(dol, sects_bitmap, all_sects_bitmap);
+		sects_bitmap |= (1 << j);
+
+		start = be32_to_cpu(dol_sect_address(dol, j));
+		end = start + di_align(be32_to_cpu(dol_sect_size(dol, j)));
+		disk_start = be32_to_cpu(dol_sect_offset(dol, j));
+		disk_end = disk_start +
+			   di_align(be32_to_cpu(dol_sect_size(dol, j)));
+
+		while ((k = next_sect(dol, sects_bitmap,
+				      all_sects_bitmap)) >= 0 &&
+		       dol_sect_follows(be32_to_cpu(dol_sect_address(dol, k)),
+					be32_to_cpu(dol_sect_offset(dol, k)),
+					end, disk_end,
+					be32_to_cpu(dol->address_bss),
+					be32_to_cpu(dol->size_bss))) {
+			sects_bitmap |= (1 << k);
+
+			end = be32_to_cpu(dol_sect_address(dol, k)) +
+			      di_align(be32_to_cpu(dol_sect_size(dol, k)));
+			disk_end = be32_to_cpu(dol_sect_offset(dol, k)) +
+				   di_align(be32_to_cpu(dol_sect_size(dol, k)));
+		}
+
+		if (disk_end > size)
+			die("read past the end of the DOL\n");
+		memcpy(ram + start - RAM_START, image + disk_start,
+		       end - start);
+		reads++;
+	}
+	return reads;
+}
+
+/**
+ * Tells if a RAM address falls within the blocks read for a section.
+ */
+static int in_section(struct dol_header *dol, unsigned long address)
+{
+	unsigned long start;
+	int k;
+
+	for (k = 0; k < DOL_MAX_SECT; k++) {
+		start = be32_to_cpu(dol_sect_address(dol, k));
+		if (address >= start && address < start +
+		    di_align(be32_to_cpu(dol_sect_size(dol, k))))
+			return 1;
+	}
+	return 0;
+}
+
+/**
+ * Checks that nothing but sections was read into [start, end).
+ */
+static void check_untouched(struct dol_header *dol, unsigned long start,
+			    unsigned long end, const char *what)
+{
+	unsigned long address;
+
+	for (address = start; address < end; address++) {
+		if (ram[address - RAM_START] != POISON &&
+		    !in_section(dol, address)) {
+			fprintf(stderr, "dol %lu: %s overwritten at 0x%08lx\n",
+				nr_dols, what, address);
+			problems++;
+			return;
+		}
+	}
+}
+
+/**
+ * Lays out a DOL, loads it and checks the result.
+ * Returns the number of reads.
+ */
+static unsigned int run_dol(uint8_t *in, unsigned long in_size)
+{
+	struct dol_header *dol = (struct dol_header *)in;
+	unsigned long out_size, address, size;
+	unsigned int reads, nr_sects;
+	int order[DOL_MAX_SECT];
+	uint8_t *out;
+	unsigned int i;
+	int k;
+
+	nr_dols++;
+	if (check_dol(dol, in_size, "input"))
+		die("dol %lu: bad input DOL\n", nr_dols);
+
+	out_size = relayout_dol(&out, in, DI_SECTOR_SIZE);
+	if (check_dol((struct dol_header *)out, out_size, "output") ||
+	    check_layout((struct dol_header *)out, DI_SECTOR_SIZE, "output")) {
+		fprintf(stderr, "dol %lu: bad layout\n", nr_dols);
+		problems++;
+	}
+
+	memset(ram, POISON, RAM_SIZE);
+	reads = load_dol(out, out_size);
+
+	nr_sects = load_order(dol, order);
+	for (i = 0; i < nr_sects; i++) {
+		k = order[i];
+		address = be32_to_cpu(dol_sect_address(dol, k));
+		size = be32_to_cpu(dol_sect_size(dol, k));
+		if (memcmp(ram + address - RAM_START,
+			   in + be32_to_cpu(dol_sect_offset(dol, k)), size)) {
+			fprintf(stderr, "dol %lu: section %d not loaded\n",
+				nr_dols, k);
+			problems++;
+		}
+	}
+
+	check_untouched(dol, RAM_START, DOL_LOWMEM_END, "low memory");
+	address = be32_to_cpu(dol->address_bss);
+	check_untouched(dol, address,
+			address + be32_to_cpu(dol->size_bss), ".bss");
+
+	nr_sections += nr_sects;
+	nr_reads += reads;
+
+	free(out);
+	return reads;
+}
+
+/**
+ * A typical kernel DOL, one text and two data sections back to back.
+ * All of them must come in a single read.
+ */
+static void test_contiguous(void)
+{
+	struct dol_header *dol;
+	unsigned long size = DOL_HEADER_SIZE + 0x1240 + 0x800 + 0x100;
+	uint8_t *in;
+	unsigned long i;
+
+	in = xmalloc(size);
+	memset(in, 0, DOL_HEADER_SIZE);
+	for (i = DOL_HEADER_SIZE; i < size; i++)
+		in[i] = random();
+	dol = (struct dol_header *)in;
+
+	set_sect(dol, 0, DOL_HEADER_SIZE, 0x80003100, 0x1234);
+	set_sect(dol, DOL_SECT_MAX_TEXT, DOL_HEADER_SIZE + 0x1240,
+		 0x80004340, 0x800);
+	set_sect(dol, DOL_SECT_MAX_TEXT + 1, DOL_HEADER_SIZE + 0x1a40,
+		 0x80004b40, 0x100);
+	dol->address_bss = cpu_to_be32(0x80004c40);
+	dol->size_bss = cpu_to_be32(0x4000);
+	dol->entry_point = cpu_to_be32(0x80003100);
+
+	if (run_dol(in, size) != 1) {
+		fprintf(stderr, "contiguous sections not read at once\n");
+		problems++;
+	}
+	free(in);
+}
+
+/**
+ * A DOL with random sections. Half of them follow the previous one in
+ * memory, some others leave a hole of up to a sector in between.
+ */
+static void test_random(void)
+{
+	struct dol_header *dol;
+	int indexes[DOL_MAX_SECT];
+	uint32_t addresses[DOL_MAX_SECT], sizes[DOL_MAX_SECT];
+	unsigned long address, offset, size;
+	unsigned int nr_sects, i, j;
+	uint8_t *in;
+	int k;
+
+	/* text section 0 holds the entry point, the rest is shuffled */
+	for (k = 0; k < DOL_MAX_SECT; k++)
+		indexes[k] = k;
+	for (i = DOL_MAX_SECT - 1; i > 1; i--) {
+		j = 1 + rnd(i);
+		k = indexes[i];
+		indexes[i] = indexes[j];
+		indexes[j] = k;
+	}
+	nr_sects = 1 + rnd(DOL_MAX_SECT);
+
+	address = rnd(2) ? DOL_LOWMEM_END : RAM_START + rnd(0x200) * 32;
+	size = DOL_HEADER_SIZE;
+	for (i = 0; i < nr_sects; i++) {
+		sizes[i] = 4 + rnd(rnd(4) ? 0x2000 : 0x20000) / 4 * 4;
+		addresses[i] = address;
+		if (i && address + di_align(sizes[i]) > RAM_START + RAM_LIMIT) {
+			nr_sects = i;
+			break;
+		}
+		size += di_align(sizes[i]);
+
+		address += di_align(sizes[i]);
+		switch (rnd(4)) {
+		case 0:
+			address += rnd(0x10000) * 32;
+			break;
+		case 1:
+			address += rnd(DOL_SECT_GAP_MAX / 32 + 1) * 32;
+			break;
+		}
+	}
+
+	in = xmalloc(size);
+	memset(in, 0, DOL_HEADER_SIZE);
+	for (i = DOL_HEADER_SIZE; i < size; i++)
+		in[i] = random();
+	dol = (struct dol_header *)in;
+
+	/* stored in section number order, unlike what dollayout does */
+	offset = DOL_HEADER_SIZE;
+	for (k = 0; k < DOL_MAX_SECT; k++) {
+		for (i = 0; i < nr_sects && indexes[i] != k; i++)
+			;
+		if (i == nr_sects)
+			continue;
+		set_sect(dol, k, offset, addresses[i], sizes[i]);
+		offset += di_align(sizes[i]);
+	}
+	dol->entry_point = cpu_to_be32(addresses[0]);
+
+	/* no .bss, one past the sections or one among them */
+	switch (rnd(3)) {
+	case 1:
+		i = nr_sects - 1;
+		dol->address_bss = cpu_to_be32(addresses[i] +
+					       di_align(sizes[i]));
+		dol->size_bss = cpu_to_be32(rnd(0x8000));
+		break;
+	case 2:
+		i = rnd(nr_sects);
+		dol->address_bss = cpu_to_be32(addresses[i] +
+					       di_align(sizes[i]) +
+					       rnd(0x40) * 32);
+		dol->size_bss = cpu_to_be32(4 + rnd(0x1000) / 4 * 4);
+		break;
+	}
+
+	run_dol(in, size);
+	free(in);
+}
+
+/**
+ *
+ */
+void layouttest_version(void)
+{
+	printf("version %s\n", LAYOUTTEST_VERSION);
+	exit(2);
+}
+
+/**
+ *
+ */
+void layouttest_usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [OPTION]" "\n"
+		"  -n, --rounds=N          random DOLs to test (default 500)" "\n"
+		"  -s, --seed=N            random seed (default 1)" "\n"
+		, __progname);
+	exit(1);
+}
+
+/**
+ *
+ */
+int main(int argc, char *argv[])
+{
+	unsigned long rounds = 500, seed = 1, i;
+	char *p;
+	int ch;
+
+	struct option long_options[] = {
+		{"rounds", 1, NULL, 'n'},
+		{"seed", 1, NULL, 's'},
+		{"version", 0, NULL, 'v'},
+		{"help", 0, NULL, 'h'},
+		{0,0,0,0}
+	};
+#define SHORT_OPTIONS "n:s:vh"
+
+	p = strrchr(argv[0], '/');
+	__progname = (p && p[1]) ? p+1 : argv[0];
+
+	while((ch = getopt_long(argc, argv, SHORT_OPTIONS,
+				long_options, NULL)) != -1) {
+		switch(ch) {
+			case 'n':
+				rounds = strtoul(optarg, &p, 0);
+				if (*p)
+					die("bad number %s\n", optarg);
+				break;
+			case 's':
+				seed = strtoul(optarg, &p, 0);
+				if (*p)
+					die("bad number %s\n", optarg);
+				break;
+			case 'v':
+				layouttest_version();
+				break;
+			case 'h':
+			case '?':
+			default:
+				layouttest_usage();
+				break;
+		}
+	}
+	if (argc != optind)
+		layouttest_usage();
+
+	srandom(seed);
+	ram = xmalloc(RAM_SIZE);
+
+	test_contiguous();
+	for (i = 0; i < rounds; i++)
+		test_random();
+
+	printf("%lu dols, %lu sections, %lu reads\n", nr_dols, nr_sections,
+	       nr_reads);
+	if (nr_reads >= nr_sections) {
+		printf("reads not coalesced\n");
+		problems++;
+	}
+
+	if (problems) {
+		printf("%d problems\n", problems);
+		return 1;
+	}
+	printf("ok\n");
+	return 0;
+}
@@ -0,0 +1,394 @@
+/*
+ * libtest.c
+ *
+ * Checks the mem* routines of the ppc stubs against the C library.
+ * This program is part of the cubeboot-tools package.
+ *
+ * Copyright (C) 2005-2006 The GameCube Linux Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+/*
+ * ppc/common/lib.c is built for the host with its routines renamed to
+ * lib_*, and with the C dcbz of ppc/include/host.h. The same operation
+ * is then run through both implementations on two copies of the same
+ * random data, and everything around the destination is compared.
+ *
+ * The first arena is mapped where the GameCube RAM is, so the dcbz fast
+ * paths are taken there. The second one is ordinary heap memory, which
+ * lib.c keeps clear of dcbz.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "../include/lib.h"
+
+#define _GNU_SOURCE
+#include <getopt.h>
+
+#define LIBTEST_VERSION "V0.1-20261018"
+
+const char *__progname;
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE	0x100000
+#endif
+
+#define RAM_START	0x80000000
+#define ARENA_SIZE	(64*1024)
+
+/* bytes checked on each side of a destination, for overruns */
+#define GUARD		64
+
+#define LINE_SIZE	32
+
+extern void *lib_memcpy(void *dest, const void *src, size_t count);
+extern void *lib_memmove(void *dest, const void *src, size_t count);
+extern int lib_memcmp(const void *cs, const void *ct, size_t count);
+extern void *lib_memset(void *s, int c, size_t count);
+extern void copy_sync_range(void *dst, const void *src, unsigned long len);
+
+struct arena {
+	const char *name;
+	uint8_t *mem;
+	unsigned long nr_checks;
+};
+
+static uint8_t *ref;			/* the C library works here */
+static int problems;
+
+/*
+ * What lib.c needs from the rest of the stub.
+ */
+void flush_dcache_range(void *start, void *stop)
+{
+	(void)start; (void)stop;
+}
+
+void invalidate_icache_range(void *start, void *stop)
+{
+	(void)start; (void)stop;
+}
+
+/* as in misc.S, each destination line is claimed before it is loaded */
+void copy_sync_lines(void *dst, const void *src, unsigned long len)
+{
+	uint32_t *d = dst;
+	const uint32_t *s = src;
+	unsigned int i;
+
+	for (; len >= LINE_SIZE; len -= LINE_SIZE) {
+		for (i = 0; i < LINE_SIZE / sizeof(*d); i++)
+			d[i] = 0;
+		for (i = 0; i < LINE_SIZE / sizeof(*d); i++)
+			*d++ = *s++;
+	}
+}
+
+void writel(unsigned long b, volatile void *addr)
+{
+	(void)b; (void)addr;
+}
+
+/**
+ * A random number in [0, n).
+ */
+static unsigned long rnd(unsigned long n)
+{
+	return (unsigned long)random() % n;
+}
+
+/**
+ * Sizes are picked around cache line multiples half of the time.
+ */
+static size_t rnd_size(size_t max)
+{
+	size_t size;
+
+	if (rnd(2)) {
+		size = rnd(max / LINE_SIZE + 1) * LINE_SIZE;
+		size += rnd(2 * sizeof(uint32_t) + 1) - sizeof(uint32_t);
+		if (size > max)
+			size = max;
+		return size;
+	}
+	return rnd(rnd(4) ? 300 : max + 1);
+}
+
+/**
+ * Gives both arenas the same random contents.
+ */
+static void fill(struct arena *a)
+{
+	uint32_t *words = (uint32_t *)a->mem;
+	size_t i;
+
+	for (i = 0; i < ARENA_SIZE / sizeof(*words); i++)
+		words[i] = random() ^ (random() << 16);
+	memcpy(ref, a->mem, ARENA_SIZE);
+}
+
+/**
+ * Compares both arenas around [offset, offset + size).
+ */
+static void check(struct arena *a, const char *what, size_t offset,
+		  size_t size, size_t src)
+{
+	size_t start, end, i;
+
+	a->nr_checks++;
+	start = (offset > GUARD) ? offset - GUARD : 0;
+	end = offset + size + GUARD;
+	if (end > ARENA_SIZE)
+		end = ARENA_SIZE;
+
+	for (i = start; i < end; i++) {
+		if (a->mem[i] != ref[i]) {
+			fprintf(stderr, "%s: %s of %zu bytes from +%zu to +%zu"
+				" differs at +%zu\n", a->name, what, size,
+				src, offset, i);
+			problems++;
+			return;
+		}
+	}
+}
+
+/**
+ * Places size bytes anywhere in the arena, with no alignment.
+ */
+static size_t rnd_offset(size_t size)
+{
+	return GUARD + rnd(ARENA_SIZE - 2 * GUARD - size);
+}
+
+/**
+ *
+ */
+static void test_memcpy(struct arena *a)
+{
+	size_t size, dst, src;
+
+	size = rnd_size(8192);
+	do {
+		dst = rnd_offset(size);
+		src = rnd_offset(size);
+	} while (dst < src + size && src < dst + size);
+
+	lib_memcpy(a->mem + dst, a->mem + src, size);
+	memcpy(ref + dst, ref + src, size);
+	check(a, "memcpy", dst, size, src);
+}
+
+/**
+ * Overlapping moves, in both directions.
+ */
+static void test_memmove(struct arena *a)
+{
+	size_t size, dst, src, delta;
+
+	size = rnd_size(8192);
+	delta = rnd(size + LINE_SIZE + 1);
+	src = GUARD + delta + rnd(ARENA_SIZE - 2 * (GUARD + delta) - size);
+	dst = rnd(2) ? src + delta : src - delta;
+
+	lib_memmove(a->mem + dst, a->mem + src, size);
+	memmove(ref + dst, ref + src, size);
+	check(a, (dst > src) ? "memmove up" : "memmove down", dst, size, src);
+}
+
+/**
+ * Zeroes half of the time, those take the dcbz path.
+ */
+static void test_memset(struct arena *a)
+{
+	size_t size, dst;
+	int c;
+
+	size = rnd_size(8192);
+	dst = rnd_offset(size);
+	c = rnd(2) ? 0 : (int)rnd(256);
+
+	lib_memset(a->mem + dst, c, size);
+	memset(ref + dst, c, size);
+	check(a, c ? "memset" : "memset zero", dst, size, 0);
+}
+
+/**
+ * Equal or almost equal buffers, only the sign of the result matters.
+ */
+static void test_memcmp(struct arena *a)
+{
+	size_t size, s1, s2;
+	int res, expected;
+
+	size = rnd_size(1024);
+	s1 = rnd_offset(size);
+	s2 = rnd_offset(size);
+	memcpy(a->mem + s2, a->mem + s1, size);
+	if (size && rnd(4))
+		a->mem[s2 + rnd(size)] = random();
+	memcpy(ref, a->mem, ARENA_SIZE);
+
+	res = lib_memcmp(a->mem + s1, a->mem + s2, size);
+	expected = memcmp(ref + s1, ref + s2, size);
+	a->nr_checks++;
+	if ((res < 0) != (expected < 0) || (res > 0) != (expected > 0)) {
+		fprintf(stderr, "%s: memcmp of %zu bytes at +%zu and +%zu"
+			" returns %d, not %d\n", a->name, size, s1, s2,
+			res, expected);
+		problems++;
+	}
+}
+
+/**
+ * The stub copies sections this way, sometimes onto a lower, overlapping
+ * destination, as long as it stays a cache line away.
+ */
+static void test_copy_sync_range(struct arena *a)
+{
+	size_t size, dst, src;
+
+	size = rnd_size(8192);
+	if (rnd(2)) {
+		src = GUARD + LINE_SIZE + size +
+		      rnd(ARENA_SIZE - 2 * GUARD - LINE_SIZE - 2 * size);
+		dst = (src - LINE_SIZE - rnd(size + 1)) & ~(LINE_SIZE - 1);
+	} else {
+		do {
+			dst = rnd_offset(size);
+			src = rnd_offset(size);
+		} while (dst < src + size && src < dst + size);
+	}
+
+	copy_sync_range(a->mem + dst, a->mem + src, size);
+	memmove(ref + dst, ref + src, size);
+	check(a, "copy_sync_range", dst, size, src);
+}
+
+/**
+ *
+ */
+static void run_tests(struct arena *a, unsigned long rounds)
+{
+	unsigned long i;
+
+	for (i = 0; i < rounds; i++) {
+		fill(a);
+		test_memcpy(a);
+		test_memmove(a);
+		test_memset(a);
+		test_memcmp(a);
+		test_copy_sync_range(a);
+	}
+	printf("%-8s %lu checks\n", a->name, a->nr_checks);
+}
+
+/**
+ *
+ */
+void version(void)
+{
+	printf("version %s\n", LIBTEST_VERSION);
+	exit(2);
+}
+
+/**
+ *
+ */
+void usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [OPTION]" "\n"
+		"  -n, --rounds=N          rounds of tests (default 2000)" "\n"
+		"  -s, --seed=N            random seed (default 1)" "\n"
+		, __progname);
+	exit(1);
+}
+
+/**
+ *
+ */
+int main(int argc, char *argv[])
+{
+	unsigned long rounds = 2000, seed = 1;
+	struct arena ram, heap;
+	char *p;
+	int ch;
+
+	struct option long_options[] = {
+		{"rounds", 1, NULL, 'n'},
+		{"seed", 1, NULL, 's'},
+		{"version", 0, NULL, 'v'},
+		{"help", 0, NULL, 'h'},
+		{0,0,0,0}
+	};
+#define SHORT_OPTIONS "n:s:vh"
+
+	p = strrchr(argv[0], '/');
+	__progname = (p && p[1]) ? p+1 : argv[0];
+
+	while((ch = getopt_long(argc, argv, SHORT_OPTIONS,
+				long_options, NULL)) != -1) {
+		switch(ch) {
+			case 'n':
+				rounds = strtoul(optarg, &p, 0);
+				if (*p)
+					die("bad number %s\n", optarg);
+				break;
+			case 's':
+				seed = strtoul(optarg, &p, 0);
+				if (*p)
+					die("bad number %s\n", optarg);
+				break;
+			case 'v':
+				version();
+				break;
+			case 'h':
+			case '?':
+			default:
+				usage();
+				break;
+		}
+	}
+	if (argc != optind)
+		usage();
+
+	srandom(seed);
+
+	ram.name = "ram";
+	ram.nr_checks = 0;
+	ram.mem = mmap((void *)RAM_START, ARENA_SIZE, PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE,
+		       -1, 0);
+	if (ram.mem != (void *)RAM_START)
+		die("Cannot map memory at 0x%08x: %s\n", RAM_START,
+		    strerror(errno));
+
+	heap.name = "heap";
+	heap.nr_checks = 0;
+	heap.mem = xmalloc(ARENA_SIZE);
+	if ((unsigned long)heap.mem - RAM_START < 24*1024*1024)
+		die("heap arena within the RAM window\n");
+
+	ref = xmalloc(ARENA_SIZE);
+
+	run_tests(&ram, rounds);
+	run_tests(&heap, rounds);
+
+	if (problems) {
+		printf("%d problems\n", problems);
+		return 1;
+	}
+	printf("ok\n");
+	return 0;
+}
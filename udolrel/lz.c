@@ -0,0 +1,147 @@
+/*
+ * lz.c
+ *
+ * Small greedy compressor producing LZ4 blocks, the format understood by
+ * the unlz() decompressor in the relocation stub.
+ * This program is part of the cubeboot-tools package.
+ *
+ * Copyright (C) 2005-2006 The GameCube Linux Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+#include <string.h>
+
+#include "../include/lz.h"
+
+#define MIN_MATCH	4
+#define MAX_OFFSET	65535
+#define LAST_LITERALS	5	/* the block must end with literals */
+#define MF_LIMIT	12	/* no match may start this close to the end */
+
+#define HASH_BITS	16
+#define HASH_SIZE	(1 << HASH_BITS)
+
+static inline uint32_t read32(const uint8_t *p)
+{
+	uint32_t val;
+
+	memcpy(&val, p, sizeof(val));
+	return val;
+}
+
+static inline uint32_t hash32(uint32_t val)
+{
+	return (val * 2654435761U) >> (32 - HASH_BITS);
+}
+
+/*
+ * Emits a length in the LZ4 token extension format.
+ */
+static uint8_t *put_length(uint8_t *op, size_t len)
+{
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = len;
+	return op;
+}
+
+/*
+ * Emits one sequence: literals followed by an optional match.
+ * Returns NULL if it doesn't fit in the output buffer.
+ */
+static uint8_t *put_sequence(uint8_t *op, uint8_t *op_end,
+			     const uint8_t *literals, size_t nr_literals,
+			     size_t offset, size_t match_len)
+{
+	uint8_t *token;
+
+	/* worst case: token, lengths, literals and offset */
+	if ((size_t)(op_end - op) < 1 + nr_literals / 255 + 1 + nr_literals +
+				     2 + match_len / 255 + 1)
+		return NULL;
+
+	token = op++;
+	*token = 0;
+
+	if (nr_literals >= 15) {
+		*token = 15 << 4;
+		op = put_length(op, nr_literals - 15);
+	} else {
+		*token = nr_literals << 4;
+	}
+	memcpy(op, literals, nr_literals);
+	op += nr_literals;
+
+	if (!match_len)
+		return op;
+
+	*op++ = offset & 0xff;
+	*op++ = offset >> 8;
+
+	match_len -= MIN_MATCH;
+	if (match_len >= 15) {
+		*token |= 15;
+		op = put_length(op, match_len - 15);
+	} else {
+		*token |= match_len;
+	}
+	return op;
+}
+
+/*
+ * Compresses src_size bytes from src into dst.
+ * Returns the compressed size, or 0 if it would not fit in dst_size bytes.
+ */
+size_t lz_compress(uint8_t *dst, size_t dst_size,
+		   const uint8_t *src, size_t src_size)
+{
+	static uint32_t table[HASH_SIZE];
+	const uint8_t *ip = src, *anchor = src, *ref;
+	const uint8_t *match_limit = src + src_size - LAST_LITERALS;
+	const uint8_t *mf_limit = src + src_size - MF_LIMIT;
+	uint8_t *op = dst, *op_end = dst + dst_size;
+	uint32_t h;
+	size_t len;
+
+	memset(table, 0xff, sizeof(table));
+
+	if (src_size >= MF_LIMIT) {
+		while (ip < mf_limit) {
+			h = hash32(read32(ip));
+			ref = (table[h] == 0xffffffff) ? NULL : src + table[h];
+			table[h] = ip - src;
+
+			if (!ref || ip - ref > MAX_OFFSET ||
+			    read32(ref) != read32(ip)) {
+				ip++;
+				continue;
+			}
+
+			len = MIN_MATCH;
+			while (ip + len < match_limit && ref[len] == ip[len])
+				len++;
+
+			op = put_sequence(op, op_end, anchor, ip - anchor,
+					  ip - ref, len);
+			if (!op)
+				return 0;
+
+			ip += len;
+			anchor = ip;
+		}
+	}
+
+	/* the remaining bytes go as literals */
+	op = put_sequence(op, op_end, anchor, src + src_size - anchor, 0, 0);
+	if (!op)
+		return 0;
+
+	return op - dst;
+}
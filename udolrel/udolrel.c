@@ -1,7 +1,7 @@
 /*
  * udolrel.c
  *
- * Converts a zImage.dol into a self-relocatable lowmem .dol
+ * Converts a zImage.dol (or a PowerPC ELF) into a self-relocatable lowmem .dol
  * This program is part of the cubeboot-tools package.
  *
  * Copyright (C) 2005-2006 The GameCube Linux Team
@@ -19,17 +19,31 @@
  * This program is currently really dumb and lacks lots of checks.
  * Use it _ONLY_ if you know what you're doing.
  *
- * Currently, the relocation engine will work _only_ if the memory areas used
- * by the original and resulting DOLs do not overlap.
+ * With --direct-load, sections which don't get in the way of the loader
+ * or the stub are left as ordinary DOL sections at their final addresses,
+ * and only the rest goes through the relocation stub.
+ *
+ * The memory areas used by the original and resulting DOLs may overlap,
+ * as long as the original DOL doesn't overlap the relocation stub itself
+ * nor the stack it runs on (which also holds its timing records).
+ * The relocation entries are then ordered (and, if needed, staged through
+ * free memory) so that no section clobbers another one before it is moved.
  *
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <errno.h>
 #include <malloc.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <elf.h>
 
 #include "../include/lib.h"
+#include "../include/lz.h"
 
 #include "../include/dol.h"
 #include "../include/dolrel.h"
@@ -37,124 +51,979 @@
 #define _GNU_SOURCE
 #include <getopt.h>
 
-#define UDOLREL_VERSION "V0.1-20060310"
+#define UDOLREL_VERSION "V0.2-20261018"
 
 const char *__progname;
 
 const unsigned int max_nr_sections = DOL_SECT_MAX_TEXT + DOL_SECT_MAX_DATA;
-struct dolrel_control control;
-struct dolrel_section sections[DOL_SECT_MAX_TEXT + DOL_SECT_MAX_DATA];
 
 void *reloc_code;
 unsigned int reloc_code_size;
 unsigned long reloc_flags;
+unsigned long xenogc_grace_msecs;
+int compress;
+int direct_load;
 
 #define DOL_ALIGN_SHIFT  5
 #define DOL_ALIGN_SIZE   (1UL << DOL_ALIGN_SHIFT)
 #define DOL_ALIGN_MASK   (~((1 << DOL_ALIGN_SHIFT) - 1))
 
-#define dol_align(addr)  (void *) \
-                        ((((unsigned long)(addr)) + \
-                                 DOL_ALIGN_SIZE - 1) & DOL_ALIGN_MASK)
+/* rounds up to a power of two boundary */
+static inline uint32_t align_up(uint32_t value, uint32_t align)
+{
+	return (value + align - 1) & ~(align - 1);
+}
+
+#define PAD_BYTE	0xaa
+
+/* zero runs at least this long become fill entries instead of payload */
+#define ZERO_RUN_MIN	256
+
+/* segments at most this far apart are merged, zero filling the gap */
+#define COALESCE_GAP_MAX	128
+
+/*
+ * A whole file, either mapped or read into memory.
+ */
+struct file_image {
+	uint8_t *data;
+	size_t size;
+	int fd;
+	int mapped;
+};
 
 /**
- *
+ * Gets the whole input in memory with a single pass.
+ * Regular files are mapped, anything else (pipes) is read until EOF.
  */
-void calc_section_sizes(struct dol_header *dh, uint32_t *largest, uint32_t *total)
+void load_input(struct file_image *in, int fd, const char *name)
 {
-	int k;
-	uint32_t sect_size;
+	struct stat stats;
+	size_t allocated;
+	ssize_t result;
+
+	memset(in, 0, sizeof(*in));
+	in->fd = fd;
+
+	if (fstat(fd, &stats) == 0 && S_ISREG(stats.st_mode) &&
+	    stats.st_size > 0) {
+		in->data = mmap(NULL, stats.st_size, PROT_READ, MAP_PRIVATE,
+				fd, 0);
+		if (in->data != MAP_FAILED) {
+			in->size = stats.st_size;
+			in->mapped = 1;
+			return;
+		}
+		in->data = NULL;
+	}
 
-	*largest = 0;
-	*total = 0;
+	allocated = 1024 * 1024;
+	in->data = xmalloc(allocated);
+	for (;;) {
+		if (in->size == allocated) {
+			allocated *= 2;
+			in->data = xrealloc(in->data, allocated);
+		}
+		result = read(fd, in->data + in->size, allocated - in->size);
+		if (result < 0) {
+			if ((errno == EINTR) || (errno == EAGAIN))
+				continue;
+			die("%s: can't read input: %s\n", name, strerror(errno));
+		}
+		if (result == 0)
+			break;
+		in->size += result;
+	}
+}
 
-	for( k = 0; k < max_nr_sections; k++) {
-		sect_size = be32_to_cpu(dol_sect_size(dh, k));
-		*total += sect_size;
-		if (sect_size > *largest)
-			*largest = sect_size;
+/**
+ * Prepares an output buffer of the given size.
+ * Regular files opened read/write are mapped, otherwise we build the
+ * image in memory and write it out in one go on finish_output().
+ */
+void map_output(struct file_image *out, int fd, size_t size)
+{
+	struct stat stats;
+
+	memset(out, 0, sizeof(*out));
+	out->fd = fd;
+	out->size = size;
+
+	if (fstat(fd, &stats) == 0 && S_ISREG(stats.st_mode) &&
+	    ftruncate(fd, size) == 0) {
+		out->data = mmap(NULL, size, PROT_READ | PROT_WRITE,
+				 MAP_SHARED, fd, 0);
+		if (out->data != MAP_FAILED) {
+			out->mapped = 1;
+			return;
+		}
 	}
+
+	out->data = xmalloc(size);
 }
 
 /**
  *
  */
-int pad(FILE *f, size_t count)
+void finish_output(struct file_image *out, const char *name)
 {
-	uint8_t data = 0xaa;
-	size_t nr_items;
+	size_t progress;
+	ssize_t result;
 
-        while (count--) {
-		nr_items = fwrite(&data, 1, 1, f);
-		if (nr_items != 1)
-			return -1;
+	if (out->mapped) {
+		if (munmap(out->data, out->size) < 0)
+			die("%s: can't unmap output: %s\n", name, strerror(errno));
+		return;
 	}
-	return 0;
+
+	for (progress = 0; progress < out->size; progress += result) {
+		result = write(out->fd, out->data + progress,
+			       out->size - progress);
+		if (result < 0) {
+			if ((errno == EINTR) || (errno == EAGAIN)) {
+				result = 0;
+				continue;
+			}
+			die("%s: can't write output: %s\n", name, strerror(errno));
+		}
+	}
+	free(out->data);
 }
 
 /**
  *
  */
-int transform_dol(FILE *fout, FILE *fin)
+void release_input(struct file_image *in)
+{
+	if (in->mapped)
+		munmap(in->data, in->size);
+	else
+		free(in->data);
+}
+
+/*
+ * A chunk of the original image, as it must end up in memory.
+ */
+struct segment {
+	uint32_t address;
+	uint32_t length;
+	const uint8_t *data;
+	int text;
+
+	/* loaded in place as a DOL section, not part of the payload */
+	int direct;
+
+	/* what goes into the payload for this segment */
+	uint32_t flags;
+	const uint8_t *packed;
+	uint32_t packed_length;
+};
+
+/*
+ * The original image, in host byte order.
+ */
+struct reloc_image {
+	uint32_t entry_point;
+	uint32_t address_bss;
+	uint32_t size_bss;
+	struct segment *segments;
+	unsigned int nr_segments;
+	struct dolrel_blob blobs[DOLREL_MAX_BLOBS];
+	unsigned int nr_blobs;
+};
+
+/*
+ * A relocation step, in host byte order, before it gets written out.
+ */
+struct reloc_entry {
+	uint32_t flags;
+	uint32_t src_address;
+	uint32_t src_length;
+	uint32_t dst_address;
+	uint32_t length;
+};
+
+/**
+ *
+ */
+static int ranges_overlap(uint32_t a, uint32_t a_len, uint32_t b, uint32_t b_len)
+{
+	return a_len && b_len &&
+	       (uint64_t)a < (uint64_t)b + b_len &&
+	       (uint64_t)b < (uint64_t)a + a_len;
+}
+
+/**
+ * Tells if a range would be in the way of the stack of the running stub.
+ */
+static int overlaps_stack(uint32_t address, uint32_t length)
+{
+	return ranges_overlap(address, length,
+			      DOLREL_STACK_TOP - DOLREL_STACK_SIZE,
+			      DOLREL_STACK_SIZE);
+}
+
+/**
+ * Sorts the non-empty sections of a DOL by ascending load address.
+ * Returns the number of sections found.
+ */
+unsigned int sort_dol_sections(struct dol_header *dol, int *order)
 {
-	struct dol_header dol_header, *dol;
-	struct dol_header new_dol_header, *new_dol;
-	struct dolrel_section *reloc_entry;
-	unsigned int nr_reloc_entries;
-	uint32_t largest_sect_size, total_sects_size, code_size, len;
-	uint32_t aligned_total_sects_size, aligned_code_size;
-	void *sect_buf;
 	unsigned int sects_bitmap;
-	unsigned long load_address_code, load_address_data;
 	unsigned long lowest_start;
-	size_t nr_items;
-	int i, j, k;
-	int result;
+	unsigned int nr_sects = 0;
+	unsigned int k;
+	int j;
+
+	sects_bitmap = (1 << max_nr_sections) - 1;
+	while(sects_bitmap) {
+		lowest_start = 0xffffffff;
+		for (j = -1, k = 0; k < max_nr_sections; k++) {
+			/* continue if section is already done */
+			if ((sects_bitmap & (1 << k)) == 0)
+				continue;
+
+			/* mark section as done if empty */
+			if (be32_to_cpu(dol_sect_size(dol, k)) == 0) {
+				sects_bitmap &= ~(1 << k);
+				continue;
+			}
+
+			/* found new candidate */
+			if (be32_to_cpu(dol_sect_address(dol, k)) < lowest_start) {
+				lowest_start = be32_to_cpu(dol_sect_address(dol, k));
+				j = k;
+			}
+		}
+		if (j < 0)
+			break;
+
+		/* mark section as being loaded */
+		sects_bitmap &= ~(1 << j);
+		order[nr_sects++] = j;
+	}
+	return nr_sects;
+}
+
+/**
+ * Validates a DOL and converts it to our internal representation.
+ */
+void load_dol_image(struct reloc_image *img, struct file_image *in)
+{
+	struct dol_header *dol;
+	uint32_t offset, len;
+	int order[DOL_MAX_SECT];
+	unsigned int i, k;
 
 	/* retrieve the original .dol header */
-	dol = &dol_header;
-	nr_items= fread(dol, sizeof(*dol), 1, fin);
-	if (nr_items != 1) {
-		die("can't read dol header: %s\n", strerror(errno));
+	if (in->size < sizeof(*dol)) {
+		die("can't read dol header: input too short\n");
+	}
+	dol = (struct dol_header *)in->data;
+
+	/* all sections must be fully contained in the input */
+	for (k = 0; k < max_nr_sections; k++) {
+		offset = be32_to_cpu(dol_sect_offset(dol, k));
+		len = be32_to_cpu(dol_sect_size(dol, k));
+		if (len && (offset > in->size || len > in->size - offset)) {
+			die("section %d (offset 0x%08x, size 0x%08x)"
+			    " is past the end of the input\n", k, offset, len);
+		}
 	}
 
-#if 0
-	if (dol_check_header(dol)) {
-		
+	memset(img, 0, sizeof(*img));
+	img->segments = xmalloc(DOL_MAX_SECT * sizeof(*img->segments));
+	img->entry_point = be32_to_cpu(dol->entry_point);
+	img->address_bss = be32_to_cpu(dol->address_bss);
+	img->size_bss = be32_to_cpu(dol->size_bss);
+
+	img->nr_segments = sort_dol_sections(dol, order);
+	for (i = 0; i < img->nr_segments; i++) {
+		k = order[i];
+		memset(&img->segments[i], 0, sizeof(img->segments[i]));
+		img->segments[i].address = be32_to_cpu(dol_sect_address(dol, k));
+		img->segments[i].length = be32_to_cpu(dol_sect_size(dol, k));
+		img->segments[i].data = in->data +
+					be32_to_cpu(dol_sect_offset(dol, k));
+		img->segments[i].text = dol_sect_is_text(dol, k);
 	}
-#endif
+}
 
-	/* pretty self explanatory */
-	calc_section_sizes(dol, &largest_sect_size, &total_sects_size);
-	aligned_total_sects_size = (uint32_t)dol_align(total_sects_size);
+/**
+ * Tells if the input looks like an ELF file.
+ */
+int is_elf_image(struct file_image *in)
+{
+	return in->size >= EI_NIDENT && !memcmp(in->data, ELFMAG, SELFMAG);
+}
+
+/*
+ * A loadable ELF segment, in host byte order.
+ */
+struct elf_load {
+	uint32_t address;
+	uint32_t vaddr;
+	uint32_t offset;
+	uint32_t filesz;
+	uint32_t memsz;
+	uint32_t flags;
+};
 
-	/* allocate a buffer large enough for the largest section */
-	sect_buf = malloc(largest_sect_size);
-	if (!sect_buf) {
-		die("can't allocate section buffer: %s\n", strerror(errno));
+/**
+ *
+ */
+static int compare_elf_loads(const void *a, const void *b)
+{
+	const struct elf_load *la = a, *lb = b;
+
+	if (la->address == lb->address)
+		return 0;
+	return (la->address < lb->address) ? -1 : 1;
+}
+
+/**
+ * Validates a 32-bit PowerPC ELF executable and converts its loadable
+ * segments to our internal representation.
+ * Segments that are contiguous in memory are merged into a single one,
+ * and the zero filled tail of the topmost segment becomes the bss.
+ */
+void load_elf_image(struct reloc_image *img, struct file_image *in)
+{
+	Elf32_Ehdr *eh;
+	Elf32_Phdr *ph;
+	struct elf_load *loads, *l;
+	struct segment *seg;
+	uint32_t phoff, entry, end, length;
+	unsigned int nr_loads = 0, phnum, i, j, k;
+	uint8_t *buf;
+	int entry_found = 0;
+
+	if (in->size < sizeof(*eh))
+		die("can't read elf header: input too short\n");
+	eh = (Elf32_Ehdr *)in->data;
+
+	if (eh->e_ident[EI_CLASS] != ELFCLASS32 ||
+	    eh->e_ident[EI_DATA] != ELFDATA2MSB ||
+	    be16_to_cpu(eh->e_type) != ET_EXEC ||
+	    be16_to_cpu(eh->e_machine) != EM_PPC)
+		die("not a 32-bit big endian PowerPC ELF executable\n");
+
+	phoff = be32_to_cpu(eh->e_phoff);
+	phnum = be16_to_cpu(eh->e_phnum);
+	if (be16_to_cpu(eh->e_phentsize) != sizeof(*ph) ||
+	    phoff > in->size || phnum * sizeof(*ph) > in->size - phoff)
+		die("bad elf program header table\n");
+
+	memset(img, 0, sizeof(*img));
+	entry = be32_to_cpu(eh->e_entry);
+
+	loads = xmalloc((phnum + 1) * sizeof(*loads));
+	for (i = 0; i < phnum; i++) {
+		ph = (Elf32_Phdr *)(in->data + phoff) + i;
+		if (be32_to_cpu(ph->p_type) != PT_LOAD || !ph->p_memsz)
+			continue;
+
+		l = &loads[nr_loads++];
+		l->vaddr = be32_to_cpu(ph->p_vaddr);
+		l->offset = be32_to_cpu(ph->p_offset);
+		l->filesz = be32_to_cpu(ph->p_filesz);
+		l->memsz = be32_to_cpu(ph->p_memsz);
+		l->flags = be32_to_cpu(ph->p_flags);
+
+		/* segments go to the cached mirror of their physical address */
+		l->address = 0x80000000 | (be32_to_cpu(ph->p_paddr) & 0x1fffffff);
+
+		if (l->filesz > l->memsz ||
+		    l->offset > in->size || l->filesz > in->size - l->offset)
+			die("segment %u (offset 0x%08x, size 0x%08x)"
+			    " is past the end of the input\n",
+			    i, l->offset, l->filesz);
+
+		if (entry >= l->vaddr && entry - l->vaddr < l->memsz) {
+			img->entry_point = entry - l->vaddr + l->address;
+			entry_found = 1;
+		}
+	}
+	if (!nr_loads)
+		die("no loadable segments found\n");
+	if (!entry_found)
+		die("entry point 0x%08x is not in a loadable segment\n", entry);
+
+	qsort(loads, nr_loads, sizeof(*loads), compare_elf_loads);
+	for (i = 1; i < nr_loads; i++) {
+		if (ranges_overlap(loads[i - 1].address, loads[i - 1].memsz,
+				   loads[i].address, loads[i].memsz))
+			die("segments at 0x%08x and 0x%08x overlap\n",
+			    loads[i - 1].address, loads[i].address);
 	}
 
-	sects_bitmap = (1 << max_nr_sections) - 1;
-	memset(sections, 0, sizeof(sections));
-	reloc_entry = &sections[0];
-	nr_reloc_entries = 0;
+	img->segments = xmalloc(nr_loads * sizeof(*img->segments));
+	for (i = 0; i < nr_loads; i = j) {
+		/* find the run of segments contiguous in memory */
+		end = loads[i].address + loads[i].memsz;
+		for (j = i + 1; j < nr_loads && loads[j].address == end; j++)
+			end = loads[j].address + loads[j].memsz;
+
+		/* the zero filled tail of the topmost segment is our bss */
+		l = &loads[j - 1];
+		if (j == nr_loads && l->memsz > l->filesz) {
+			img->address_bss = l->address + l->filesz;
+			img->size_bss = l->memsz - l->filesz;
+			end = img->address_bss;
+		}
+
+		length = end - loads[i].address;
+		if (!length)
+			continue;
+
+		seg = &img->segments[img->nr_segments++];
+		memset(seg, 0, sizeof(*seg));
+		seg->address = loads[i].address;
+		seg->length = length;
+
+		/* a lone segment fully backed by the file needs no copy */
+		if (j == i + 1 && loads[i].filesz == length) {
+			seg->data = in->data + loads[i].offset;
+			seg->text = !!(loads[i].flags & PF_X);
+			continue;
+		}
+
+		buf = xmalloc(length);
+		memset(buf, 0, length);
+		for (k = i; k < j; k++) {
+			l = &loads[k];
+			memcpy(buf + (l->address - seg->address),
+			       in->data + l->offset,
+			       (l->address + l->filesz > end) ?
+					end - l->address : l->filesz);
+			if (l->flags & PF_X)
+				seg->text = 1;
+		}
+		seg->data = buf;
+	}
+
+	free(loads);
+}
+
+/**
+ *
+ */
+static struct segment *append_segment(struct segment **segments,
+				      unsigned int *nr, unsigned int *allocated,
+				      struct segment *from, uint32_t offset,
+				      uint32_t length, uint32_t flags)
+{
+	struct segment *seg;
+
+	if (*nr == *allocated) {
+		*allocated *= 2;
+		*segments = xrealloc(*segments, *allocated * sizeof(**segments));
+	}
+	seg = &(*segments)[(*nr)++];
+	memset(seg, 0, sizeof(*seg));
+	seg->address = from->address + offset;
+	seg->length = length;
+	seg->data = from->data + offset;
+	seg->text = from->text;
+	seg->direct = from->direct;
+	seg->flags = flags;
+	return seg;
+}
+
+/**
+ * Merges the segments that are contiguous in memory, or separated by
+ * small gaps, so each run takes a single relocation entry.
+ * Segments must be sorted by address.
+ */
+void coalesce_segments(struct reloc_image *img)
+{
+	struct segment *seg, *next;
+	unsigned int i, j, k, nr = 0;
+	uint32_t end, length;
+	uint8_t *buf;
+	int text;
+
+	for (i = 0; i < img->nr_segments; i = j) {
+		seg = &img->segments[i];
+		end = seg->address + seg->length;
+		text = seg->text;
+		for (j = i + 1; j < img->nr_segments; j++) {
+			next = &img->segments[j];
+			if (next->address < end ||
+			    next->address - end > COALESCE_GAP_MAX)
+				break;
+			end = next->address + next->length;
+			text |= next->text;
+		}
+
+		if (j > i + 1) {
+			length = end - seg->address;
+			buf = xmalloc(length);
+			memset(buf, 0, length);
+			for (k = i; k < j; k++) {
+				next = &img->segments[k];
+				memcpy(buf + (next->address - seg->address),
+				       next->data, next->length);
+			}
+			seg->data = buf;
+			seg->length = length;
+			seg->text = text;
+		}
+		img->segments[nr++] = *seg;
+	}
+	img->nr_segments = nr;
+}
+
+/**
+ * Adds an extra payload to the image, as described by a FILE@ADDR spec.
+ * Blobs get relocated like the rest of the segments, and their placement
+ * is published in the control header.
+ */
+void add_blob(struct reloc_image *img, const char *spec)
+{
+	struct segment *seg;
+	char *filename, *at, *end;
+	unsigned long address;
+	off_t size;
+	uint8_t *data;
+	unsigned int i;
+
+	filename = strdup(spec);
+	at = strrchr(filename, '@');
+	if (!at || at == filename)
+		die("%s: blob must be given as FILE@ADDR\n", spec);
+	*at++ = 0;
+	address = strtoul(at, &end, 0);
+	if (!*at || *end)
+		die("%s: bad blob address\n", spec);
+
+	data = (uint8_t *)slurp_file(filename, &size);
+	if (address < 0x80000000 || address >= DOLREL_MEM_END ||
+	    (unsigned long)size > DOLREL_MEM_END - address)
+		die("%s: blob (size 0x%08lx) doesn't fit in memory\n",
+		    spec, (unsigned long)size);
+
+	for (i = 0; i < img->nr_segments; i++) {
+		seg = &img->segments[i];
+		if (ranges_overlap(address, size, seg->address, seg->length))
+			die("%s: blob overlaps the section at 0x%08x\n",
+			    spec, seg->address);
+	}
+	if (ranges_overlap(address, size, img->address_bss, img->size_bss))
+		die("%s: blob overlaps the bss\n", spec);
+
+	/* blobs usually go near the top of memory, where the stub stack is */
+	if (overlaps_stack(address, size))
+		die("%s: blob overlaps the stub stack at 0x%08x-0x%08x,"
+		    " place it below or above\n", spec,
+		    DOLREL_STACK_TOP - DOLREL_STACK_SIZE, DOLREL_STACK_TOP);
+
+	img->blobs[img->nr_blobs].address = address;
+	img->blobs[img->nr_blobs].size = size;
+	img->nr_blobs++;
+
+	if (!size)
+		return;
+
+	img->segments = xrealloc(img->segments, (img->nr_segments + 1) *
+						sizeof(*img->segments));
+	seg = &img->segments[img->nr_segments++];
+	memset(seg, 0, sizeof(*seg));
+	seg->address = address;
+	seg->length = size;
+	seg->data = data;
+}
+
+/**
+ * Picks the segments that the loader can place directly.
+ * Those must be properly aligned, stay clear of the lowmem area used by
+ * the loader and of the apploader itself, and there must be a free DOL
+ * section of their kind left for them. Sections on the stack of the stub
+ * (right below DOLREL_STACK_TOP) would be clobbered while it runs.
+ * Segments which end up under the payload are taken back later.
+ */
+void choose_direct_segments(struct reloc_image *img)
+{
+	/* text[0] holds the payload and text[1] the stub */
+	unsigned int free_text = DOL_SECT_MAX_TEXT - 2;
+	unsigned int free_data = DOL_SECT_MAX_DATA;
+	unsigned int *slots;
+	struct segment *seg;
+	unsigned int i;
+
+	for (i = 0; i < img->nr_segments; i++) {
+		seg = &img->segments[i];
+		seg->direct = 0;
+
+		slots = seg->text ? &free_text : &free_data;
+		if (!*slots)
+			continue;
+		if (seg->address & ~DOL_ALIGN_MASK)
+			continue;
+		if (seg->address < DOLREL_STUB_ADDRESS ||
+		    (uint64_t)seg->address + seg->length > DOLREL_LOAD_LIMIT)
+			continue;
+		if (overlaps_stack(seg->address, seg->length))
+			continue;
+
+		seg->direct = 1;
+		(*slots)--;
+	}
+}
+
+/**
+ * Splits the long zero runs out of the segments as fill segments.
+ * Those take no room in the payload, the stub clears them in place.
+ * Only whole cache lines of the destination are turned into fills.
+ */
+void split_zero_runs(struct reloc_image *img)
+{
+	struct segment *segments, *seg;
+	unsigned int nr = 0, allocated;
+	uint32_t start, pos, run_start, fill_start, fill_end;
+	unsigned int i;
+
+	allocated = 2 * img->nr_segments + 1;
+	segments = xmalloc(allocated * sizeof(*segments));
+
+	for (i = 0; i < img->nr_segments; i++) {
+		seg = &img->segments[i];
+		start = pos = 0;
+		while (!seg->direct && pos < seg->length) {
+			if (seg->data[pos]) {
+				pos++;
+				continue;
+			}
+			run_start = pos;
+			while (pos < seg->length && !seg->data[pos])
+				pos++;
+
+			fill_start = (seg->address + run_start +
+				      DOL_ALIGN_SIZE - 1) & DOL_ALIGN_MASK;
+			fill_end = (seg->address + pos) & DOL_ALIGN_MASK;
+			if (fill_end <= fill_start ||
+			    fill_end - fill_start < ZERO_RUN_MIN)
+				continue;
+			fill_start -= seg->address;
+			fill_end -= seg->address;
+
+			if (fill_start > start)
+				append_segment(&segments, &nr, &allocated, seg,
+					       start, fill_start - start, 0);
+			append_segment(&segments, &nr, &allocated, seg,
+				       fill_start, fill_end - fill_start,
+				       DOLREL_SECT_FILL);
+			start = fill_end;
+		}
+		if (start < seg->length)
+			append_segment(&segments, &nr, &allocated, seg,
+				       start, seg->length - start, 0);
+	}
+
+	free(img->segments);
+	img->segments = segments;
+	img->nr_segments = nr;
+}
+
+/**
+ * Decides what gets stored in the payload for each segment.
+ * Segments are LZ compressed if requested and if that makes them smaller.
+ */
+void pack_segments(struct reloc_image *img)
+{
+	struct segment *seg;
+	uint8_t *buf;
+	size_t len;
+	unsigned int i;
+
+	for (i = 0; i < img->nr_segments; i++) {
+		seg = &img->segments[i];
+		if (seg->direct) {
+			seg->flags = 0;
+			seg->packed = seg->data;
+			seg->packed_length = seg->length;
+			continue;
+		}
+		if (seg->flags & DOLREL_SECT_FILL) {
+			seg->packed = seg->data;
+			seg->packed_length = 0;
+			continue;
+		}
+		seg->flags = 0;
+		seg->packed = seg->data;
+		seg->packed_length = seg->length;
+
+		if (!compress || seg->length <= DOL_ALIGN_SIZE)
+			continue;
+
+		/* only worth it if we save at least a cache line */
+		buf = xmalloc(seg->length);
+		len = lz_compress(buf, seg->length - DOL_ALIGN_SIZE,
+				  seg->data, seg->length);
+		if (!len) {
+			free(buf);
+			continue;
+		}
+		seg->flags = DOLREL_SECT_LZ;
+		seg->packed = buf;
+		seg->packed_length = len;
+	}
+}
+
+/**
+ * Moves the source of an entry to scratch memory, recording the move
+ * in the plan.
+ */
+static uint32_t stage_entry(struct reloc_entry *plan, struct reloc_entry *e,
+			    uint32_t scratch_address)
+{
+	/* skip over the stub stack, should it be in the way */
+	if (overlaps_stack(scratch_address, e->src_length))
+		scratch_address = DOLREL_STACK_TOP;
+
+	plan->flags = DOLREL_SECT_SCRATCH;
+	plan->src_address = e->src_address;
+	plan->src_length = e->src_length;
+	plan->dst_address = scratch_address;
+	plan->length = e->src_length;
+
+	e->src_address = scratch_address;
+	return scratch_address + align_up(e->src_length, DOL_ALIGN_SIZE);
+}
+
+/**
+ * Orders the relocation entries so that no copy clobbers the source of
+ * a copy still pending.
+ *
+ * An entry is ready when its destination doesn't overlap the source of
+ * any other pending entry. Ready entries are emitted in address order.
+ * If nothing is ready the remaining entries depend on each other, and
+ * the cycle is broken by first moving the smallest blocking source to
+ * scratch memory at scratch_address, which is above anything in use,
+ * keeping clear of the stub stack.
+ * Compressed entries can't be expanded over their own source, so those
+ * get staged too. Fill entries have no source, so they never block others
+ * and never need staging. Finally, plain entries whose destination overlaps their
+ * own source above it are marked to be copied backwards.
+ *
+ * Returns the number of entries in plan, which must have room for
+ * twice as many entries as given.
+ */
+unsigned int plan_relocation(struct reloc_entry *plan,
+			     struct reloc_entry *entries, unsigned int nr,
+			     uint32_t scratch_address)
+{
+	struct reloc_entry *e, *f, *best;
+	unsigned int nr_plan = 0, nr_left = nr;
+	int blocked;
+	unsigned int i, j;
+	uint8_t done[nr];
+
+	memset(done, 0, sizeof(done));
+	while (nr_left > 0) {
+		best = NULL;
+		for (i = 0; i < nr; i++) {
+			if (done[i])
+				continue;
+			e = &entries[i];
+			for (blocked = 0, j = 0; j < nr && !blocked; j++) {
+				if (j == i || done[j])
+					continue;
+				f = &entries[j];
+				blocked = ranges_overlap(e->dst_address, e->length,
+							 f->src_address, f->src_length);
+			}
+			if (!blocked &&
+			    (!best || e->dst_address < best->dst_address))
+				best = e;
+		}
+
+		if (best) {
+			if (best->flags & DOLREL_SECT_LZ &&
+			    ranges_overlap(best->dst_address, best->length,
+					   best->src_address, best->src_length))
+				scratch_address = stage_entry(&plan[nr_plan++],
+							      best,
+							      scratch_address);
+			plan[nr_plan++] = *best;
+			done[best - entries] = 1;
+			nr_left--;
+			continue;
+		}
 
-	/* calculate the final stub size */
-	code_size = reloc_code_size + sizeof(control) + sizeof(sections);
-	aligned_code_size = (uint32_t)dol_align(code_size);
+		/* dependency cycle, stage the smallest pending source */
+		for (i = 0; i < nr; i++) {
+			if (done[i] || !entries[i].src_length)
+				continue;
+			if (!best || entries[i].src_length < best->src_length)
+				best = &entries[i];
+		}
+		scratch_address = stage_entry(&plan[nr_plan++], best,
+					      scratch_address);
+	}
+
+	for (i = 0; i < nr_plan; i++) {
+		e = &plan[i];
+		if (!(e->flags & DOLREL_SECT_LZ) &&
+		    e->dst_address > e->src_address &&
+		    ranges_overlap(e->dst_address, e->length,
+				   e->src_address, e->src_length))
+			e->flags |= DOLREL_SECT_BACKWARD;
+	}
+
+	return nr_plan;
+}
+
+/**
+ *
+ */
+void transform_image(struct file_image *out, int fd, const char *outfile,
+		     struct reloc_image *img)
+{
+	struct dol_header *new_dol;
+	struct dolrel_control *control;
+	struct dolrel_section *reloc_entry;
+	struct reloc_entry *entries, *plan;
+	struct segment *seg;
+	unsigned int nr_entries, nr_plan, capacity;
+	uint32_t total_sects_size, code_size, direct_size;
+	uint32_t aligned_total_sects_size, aligned_code_size;
+	uint32_t src_address, end_address, scratch_address, offset;
+	unsigned long load_address_code, load_address_data;
+	unsigned int next_text, next_data;
+	int demoted;
+	uint8_t *p;
+	unsigned int i, k;
+
+	entries = xmalloc(img->nr_segments * sizeof(*entries));
+	plan = xmalloc(2 * img->nr_segments * sizeof(*plan));
+
+	/* the relocation stub will be loaded at this address */
+	load_address_code = DOLREL_STUB_ADDRESS;
 
 	/*
-	 * The resulting .dol will contain just a data and a text section.
+	 * The stub size depends on the relocation table size, and the
+	 * relocation plan depends on where the stub ends. Grow the table
+	 * until the plan fits. Direct segments which end up under the
+	 * payload are moved into it, which starts it all over again.
 	 */
+	capacity = 0;
+	for (;;) {
+		total_sects_size = 0;
+		nr_entries = 0;
+		for (i = 0; i < img->nr_segments; i++) {
+			if (img->segments[i].direct)
+				continue;
+			/* each entry starts on a cache line in the payload */
+			total_sects_size +=
+				align_up(img->segments[i].packed_length,
+					 DOL_ALIGN_SIZE);
+			nr_entries++;
+		}
+		aligned_total_sects_size = align_up(total_sects_size,
+						    DOL_ALIGN_SIZE);
+		if (capacity < nr_entries)
+			capacity = nr_entries;
+
+		/* calculate the final stub size */
+		code_size = reloc_code_size + sizeof(*control) +
+			    capacity * sizeof(*reloc_entry);
+		aligned_code_size = align_up(code_size, DOL_ALIGN_SIZE);
+
+		/* the original sections will be loaded right after the stub */
+		load_address_data = load_address_code + aligned_code_size;
+
+		src_address = load_address_data;
+		end_address = load_address_data + aligned_total_sects_size;
+		demoted = 0;
+		for (i = 0, k = 0; i < img->nr_segments; i++) {
+			seg = &img->segments[i];
+			if (ranges_overlap(seg->address, seg->length,
+					   load_address_code, aligned_code_size))
+				die("section at 0x%08x (size 0x%08x) overlaps"
+				    " the relocation stub at 0x%08lx\n",
+				    seg->address, seg->length,
+				    load_address_code);
+
+			if (seg->address + seg->length > end_address)
+				end_address = seg->address + seg->length;
+
+			if (seg->direct) {
+				if (ranges_overlap(seg->address, seg->length,
+						   load_address_data,
+						   aligned_total_sects_size)) {
+					seg->direct = 0;
+					demoted = 1;
+				}
+				continue;
+			}
 
-	/* the relocation stub will be loaded at this address */
-	load_address_code = 0x80003100;
+			entries[k].flags = seg->flags;
+			entries[k].src_address = src_address;
+			entries[k].src_length = seg->packed_length;
+			entries[k].dst_address = seg->address;
+			entries[k].length = seg->length;
+			src_address += align_up(seg->packed_length,
+						DOL_ALIGN_SIZE);
+			k++;
+		}
+		if (demoted)
+			continue;
+
+		/* staged moves go above everything, around our stack */
+		scratch_address = align_up(end_address, DOL_ALIGN_SIZE);
+
+		nr_plan = plan_relocation(plan, entries, nr_entries,
+					  scratch_address);
+		if (nr_plan <= capacity)
+			break;
+		capacity = nr_plan;
+	}
 
-	/* the original sections will be loaded right after the stub */
-	load_address_data = load_address_code + aligned_code_size;
+	for (i = 0; i < nr_plan; i++) {
+		if (plan[i].flags & DOLREL_SECT_SCRATCH &&
+		    plan[i].dst_address + plan[i].length > DOLREL_MEM_END)
+			die("not enough free memory to stage overlapping"
+			    " sections\n");
+
+		/* the stub runs on that stack while it relocates */
+		if (overlaps_stack(plan[i].src_address, plan[i].src_length) ||
+		    overlaps_stack(plan[i].dst_address, plan[i].length))
+			die("relocation of 0x%08x (size 0x%08x) to 0x%08x"
+			    " would clobber the stub stack at 0x%08x\n",
+			    plan[i].src_address, plan[i].length,
+			    plan[i].dst_address,
+			    DOLREL_STACK_TOP - DOLREL_STACK_SIZE);
+	}
+
+	if (overlaps_stack(load_address_data, aligned_total_sects_size))
+		die("payload (size 0x%08x) runs into the stub stack at"
+		    " 0x%08x\n", aligned_total_sects_size,
+		    DOLREL_STACK_TOP - DOLREL_STACK_SIZE);
+
+	/* the stub clears the bss right before jumping to the entry point */
+	if (overlaps_stack(img->address_bss, img->size_bss))
+		die("bss overlaps the stub stack at 0x%08x\n",
+		    DOLREL_STACK_TOP - DOLREL_STACK_SIZE);
+	if (ranges_overlap(img->address_bss, img->size_bss,
+			   load_address_code, aligned_code_size))
+		die("bss overlaps the relocation stub at 0x%08lx\n",
+		    load_address_code);
+
+	direct_size = 0;
+	for (i = 0; i < img->nr_segments; i++) {
+		if (img->segments[i].direct)
+			direct_size += align_up(img->segments[i].length,
+						DOL_ALIGN_SIZE);
+	}
+
+	/* we know the final size beforehand, so lay it all out at once */
+	map_output(out, fd, sizeof(*new_dol) + aligned_total_sects_size +
+				aligned_code_size + direct_size);
+	p = out->data;
 
 	/* this is the new .dol header */
-	new_dol = &new_dol_header;
+	new_dol = (struct dol_header *)p;
 	memset(new_dol, 0, sizeof(*new_dol));
 
 	/*
@@ -179,102 +1048,164 @@ int transform_dol(FILE *fout, FILE *fin)
 
 	/* our entry point becomes our relocation stub */
 	new_dol->entry_point = cpu_to_be32(load_address_code);
-
-	/* write the new .dol header */
-	nr_items = fwrite(new_dol, sizeof(*new_dol), 1, fout);
-	if (nr_items != 1) {
-		die("can't write dol header: %s\n", strerror(errno));
+	p += sizeof(*new_dol);
+
+	/* pack all sections into the new .dol data section */
+	for (i = 0; i < img->nr_segments; i++) {
+		seg = &img->segments[i];
+		if (seg->direct)
+			continue;
+		memcpy(p, seg->packed, seg->packed_length);
+		memset(p + seg->packed_length, PAD_BYTE,
+		       align_up(seg->packed_length, DOL_ALIGN_SIZE) -
+		       seg->packed_length);
+		p += align_up(seg->packed_length, DOL_ALIGN_SIZE);
 	}
 
-	/* write all sections into the new .dol data section */
-	while(sects_bitmap) {
-		lowest_start = 0xffffffff;
-		for (j = -1, k = 0; k < max_nr_sections; k++) {
-			/* continue if section is already done */
-			if ((sects_bitmap & (1 << k)) == 0)
-				continue;
+	/* the stub, its control header and the relocation table */
+	p = out->data + be32_to_cpu(new_dol->offset_text[1]);
+	memcpy(p, reloc_code, reloc_code_size);
+	control = (struct dolrel_control *)(p + reloc_code_size);
+	reloc_entry = (struct dolrel_section *)(control + 1);
 
-			/* mark section as done if empty */
-			if (be32_to_cpu(dol_sect_size(dol, k)) == 0) {
-				sects_bitmap &= ~(1 << k);
-				continue;
-			}
+	/* stub control header */
+	memset(control, 0, sizeof(*control));
+	control->version = cpu_to_be32(DOLREL_VERSION);
 
-			/* found new candidate */
-			if (be32_to_cpu(dol_sect_address(dol, k)) < lowest_start) {
-				lowest_start = be32_to_cpu(dol_sect_address(dol, k));
-				j = k;
-			}
-		}
+	control->flags = cpu_to_be32(reloc_flags);
 
-		/* mark section as being loaded */
-		sects_bitmap &= ~(1 << j);
+	control->entry_point = cpu_to_be32(img->entry_point);
+	control->address_bss = cpu_to_be32(img->address_bss);
+	control->size_bss = cpu_to_be32(img->size_bss);
+	control->src_address = cpu_to_be32(load_address_data);
 
-		result = fseek(fin, be32_to_cpu(dol_sect_offset(dol, j)),
-			       SEEK_SET);
-		if (result < 0) {
-			die("can't seek to section: %s\n", strerror(errno));
-		}
+	control->nr_sections = cpu_to_be32(nr_plan);
 
-		len = be32_to_cpu(dol_sect_size(dol, j));
-		nr_items = fread(sect_buf, len, 1, fin);
-		if (nr_items != 1) {
-			die("can't read section: %s\n", strerror(errno));
-		}
+	control->xenogc_grace_msecs = cpu_to_be32(xenogc_grace_msecs);
 
-		nr_items = fwrite(sect_buf, len, 1, fout);
-		if (nr_items != 1) {
-			die("can't write section: %s\n", strerror(errno));
-		}
-
-		reloc_entry->dst_address = (void *)dol_sect_address(dol, j);
-		reloc_entry->length = cpu_to_be32(len);
-		reloc_entry++;
-		nr_reloc_entries++;
+	control->nr_blobs = cpu_to_be32(img->nr_blobs);
+	for (i = 0; i < img->nr_blobs; i++) {
+		control->blobs[i].address = cpu_to_be32(img->blobs[i].address);
+		control->blobs[i].size = cpu_to_be32(img->blobs[i].size);
 	}
 
-	/* data section padding */
-	result = pad(fout, aligned_total_sects_size - total_sects_size);
-	if (result) {
-		die("can't write data section padding: %s\n", strerror(errno));
+	/* stub relocation table */
+	for (i = 0; i < nr_plan; i++, reloc_entry++) {
+		reloc_entry->flags = cpu_to_be32(plan[i].flags);
+		reloc_entry->src_address = cpu_to_be32(plan[i].src_address);
+		reloc_entry->src_length = cpu_to_be32(plan[i].src_length);
+		reloc_entry->dst_address = cpu_to_be32(plan[i].dst_address);
+		reloc_entry->length = cpu_to_be32(plan[i].length);
 	}
-	
-	/* write our stub into the new .dol code section */
 
-	/* stub code */
-	nr_items = fwrite(reloc_code, reloc_code_size, 1, fout);
-	if (nr_items != 1) {
-		die("can't write relocation code: %s\n", strerror(errno));
-	}
+	/* code section padding */
+	memset(reloc_entry, PAD_BYTE,
+	       aligned_code_size - reloc_code_size - sizeof(*control) -
+	       nr_plan * sizeof(*reloc_entry));
+
+	/* direct sections follow, in the remaining DOL sections */
+	offset = be32_to_cpu(new_dol->offset_text[1]) + aligned_code_size;
+	next_text = 2;
+	next_data = 0;
+	for (i = 0; i < img->nr_segments; i++) {
+		seg = &img->segments[i];
+		if (!seg->direct)
+			continue;
+
+		if (seg->text) {
+			k = next_text++;
+			new_dol->offset_text[k] = cpu_to_be32(offset);
+			new_dol->address_text[k] = cpu_to_be32(seg->address);
+			new_dol->size_text[k] = cpu_to_be32(seg->length);
+		} else {
+			k = next_data++;
+			new_dol->offset_data[k] = cpu_to_be32(offset);
+			new_dol->address_data[k] = cpu_to_be32(seg->address);
+			new_dol->size_data[k] = cpu_to_be32(seg->length);
+		}
 
-	/* stub control header */
-	control.version = cpu_to_be32(0xdead0001);
+		p = out->data + offset;
+		memcpy(p, seg->data, seg->length);
+		memset(p + seg->length, PAD_BYTE,
+		       align_up(seg->length, DOL_ALIGN_SIZE) - seg->length);
+		offset += align_up(seg->length, DOL_ALIGN_SIZE);
+	}
 
-	control.flags = cpu_to_be32(reloc_flags);
+	free(entries);
+	free(plan);
 
-	control.entry_point = (void *)dol->entry_point;
-	control.address_bss = (void *)dol->address_bss;
-	control.size_bss = dol->size_bss;
-	control.src_address = (void *)cpu_to_be32(load_address_data);
+	finish_output(out, outfile);
+}
 
-	control.nr_sections = cpu_to_be32(nr_reloc_entries);
+/**
+ * Returns the run flags supported by a relocation engine image, as
+ * advertised by its control header template, or -1 if it isn't an
+ * engine image we know about.
+ */
+static long releng_flags(void *image, off_t size)
+{
+	struct dolrel_control *template;
+
+	if (size < (off_t)sizeof(*template))
+		return -1;
+	template = image + size - sizeof(*template);
+	if (be32_to_cpu(template->version) != DOLREL_VERSION)
+		return -1;
+	return be32_to_cpu(template->flags);
+}
 
-	nr_items = fwrite(&control, sizeof(control), 1, fout);
-	if (nr_items != 1) {
-		die("can't write relocation control: %s\n", strerror(errno));
+/**
+ * Loads the smallest relocation engine supporting the given run flags.
+ * Besides PATH.bin, its variants specialized at build time are
+ * considered too, those are named PATH-<flags>.bin.
+ */
+void *load_releng(const char *path, unsigned long flags, off_t *size)
+{
+	void *image, *best = NULL;
+	off_t image_size, best_size = 0;
+	const char *ext;
+	char *variant;
+	unsigned long v;
+	long supported;
+	int len;
+
+	ext = strrchr(path, '.');
+	len = (ext && !strchr(ext, '/')) ? ext - path : (int)strlen(path);
+	variant = xmalloc(len + sizeof("-ffffffff.bin"));
+
+	for (v = 0; v <= DOLREL_FLAG_ALL; v++) {
+		if ((v & flags) != flags)
+			continue;
+		sprintf(variant, "%.*s-%lx.bin", len, path, v);
+		if (access(variant, R_OK))
+			continue;
+
+		image = slurp_file(variant, &image_size);
+		supported = releng_flags(image, image_size);
+		if (supported < 0 || (supported & flags) != flags ||
+		    (best && image_size >= best_size)) {
+			free(image);
+			continue;
+		}
+		free(best);
+		best = image;
+		best_size = image_size;
 	}
-
-	/* stub relocation table */
-	nr_items = fwrite(sections, sizeof(sections), 1, fout);
-	if (nr_items != 1) {
-		die("can't write relocation table: %s\n", strerror(errno));
+	free(variant);
+
+	if (!best) {
+		best = slurp_file(path, &best_size);
+		supported = releng_flags(best, best_size);
+		if (supported < 0)
+			die("%s: not a relocation engine image, or a version"
+			    " mismatch\n", path);
+		if ((supported & flags) != flags)
+			die("%s: relocation engine built without support for"
+			    " flags 0x%lx\n", path, flags & ~supported);
 	}
 
-	/* code section padding */
-	result = pad(fout, aligned_code_size - code_size);
-	if (result) {
-		die("can't write text section padding: %s\n", strerror(errno));
-	}
+	*size = best_size;
+	return best;
 }
 
 /**
@@ -297,10 +1228,23 @@ void usage(void)
 						"\n"
                 "  -x, --disable-xenogc    disable xenogc on startup"
 						" (implies -s)" "\n"
+                "  -g, --xenogc-grace=MSECS  wait MSECS before polling the"
+						" disabled xenogc" "\n"
+                "                          (default 0)" "\n"
+                "  -z, --compress          LZ compress the relocated sections"
+						"\n"
+                "  -l, --lc-dma            relocate through the locked cache"
+						" dma engine" "\n"
+                "  -d, --direct-load       let the loader place sections that"
+						" don't need relocation" "\n"
+                "  -a, --append-blob=FILE@ADDR  place FILE at ADDR too"
+						" (up to %d times)" "\n"
                 "  -r, --releng=PATH       relocation engine image"
-						" (default sdre.bin)" "\n"
+						" (default sdre.bin)," "\n"
+                "                          or its smallest PATH-<flags>.bin"
+						" variant that fits" "\n"
                 "  -o, --outfile=PATH      output file (default stdout)" "\n"
-                , __progname);
+                , __progname, DOLREL_MAX_BLOBS);
         exit(1);
 }
 
@@ -310,24 +1254,34 @@ void usage(void)
 int main(int argc, char *argv[])
 {
 	char *outfile = NULL, *infile = NULL;
-	FILE *fout, *fin;
+	int fout, fin;
+	struct file_image in, out;
+	struct reloc_image img;
 	char *sdre_bin = "sdre.bin";
+	char *blob_specs[DOLREL_MAX_BLOBS];
+	unsigned int nr_blob_specs = 0;
 	void *sdre_image;
 	off_t sdre_size;
         char *p;
+	unsigned int i;
 	int ch;
 	int result;
 
         struct option long_options[] = {
                 {"stop-motor", 0, NULL, 's'},
                 {"disable-xenogc", 0, NULL, 'x'},
+                {"xenogc-grace", 1, NULL, 'g'},
+                {"compress", 0, NULL, 'z'},
+                {"lc-dma", 0, NULL, 'l'},
+                {"direct-load", 0, NULL, 'd'},
+                {"append-blob", 1, NULL, 'a'},
                 {"releng", 1, NULL, 'r'},
                 {"outfile", 1, NULL, 'o'},
                 {"version", 0, NULL, 'v'},
                 {"help", 0, NULL, 'h'},
                 {0,0,0,0}
         };
-#define SHORT_OPTIONS "sxr:o:vh"
+#define SHORT_OPTIONS "sxg:zlda:r:o:vh"
 
         p = strrchr(argv[0], '/');
         __progname = (p && p[1]) ? p+1 : argv[0];
@@ -343,6 +1297,26 @@ int main(int argc, char *argv[])
  			case 'x':
 				reloc_flags |= DOLREL_FLAG_DISABLE_XENOGC;
 				break;
+			case 'g':
+				xenogc_grace_msecs = strtoul(optarg, &p, 0);
+				if (*p)
+					die("bad grace period %s\n", optarg);
+				break;
+			case 'z':
+				compress = 1;
+				break;
+			case 'l':
+				reloc_flags |= DOLREL_FLAG_LC_DMA;
+				break;
+			case 'd':
+				direct_load = 1;
+				break;
+			case 'a':
+				if (nr_blob_specs == DOLREL_MAX_BLOBS)
+					die("too many blobs, up to %d are"
+					    " supported\n", DOLREL_MAX_BLOBS);
+				blob_specs[nr_blob_specs++] = optarg;
+				break;
 			case 'r':
 				sdre_bin = optarg;
                                 break;
@@ -368,14 +1342,14 @@ int main(int argc, char *argv[])
 
 	if (!infile) {
 		infile = "*stdin*";
-		fin = stdin;
+		fin = STDIN_FILENO;
 	} else {
 		if (!strcmp(infile, "-")) {
 			infile = "*stdin*";
-			fin = stdin;
+			fin = STDIN_FILENO;
 		} else {
-			fin = fopen(infile, "r");
-			if (!fin) {
+			fin = open(infile, O_RDONLY);
+			if (fin < 0) {
 				die("%s: can't open input file: %s\n",
 					infile, strerror(errno));
 			}
@@ -384,28 +1358,50 @@ int main(int argc, char *argv[])
 
 	if (!outfile) {
 		outfile = "*stdout*";
-		fout = stdout;
+		fout = STDOUT_FILENO;
 	} else {
 		if (!strcmp(outfile, "-")) {
 			outfile = "*stdout*";
-			fout = stdout;
+			fout = STDOUT_FILENO;
 		} else {
-			fout = fopen(outfile, "w");
-			if (!fout) {
+			fout = open(outfile, O_RDWR | O_CREAT | O_TRUNC, 0666);
+			if (fout < 0) {
 				die("%s: can't open output file: %s\n",
 					outfile, strerror(errno));
 			}
 		}
 	}
 
-	sdre_image = slurp_file(sdre_bin, &sdre_size);
+	load_input(&in, fin, infile);
+	if (is_elf_image(&in))
+		load_elf_image(&img, &in);
+	else
+		load_dol_image(&img, &in);
+	coalesce_segments(&img);
+	for (i = 0; i < nr_blob_specs; i++)
+		add_blob(&img, blob_specs[i]);
+	if (direct_load)
+		choose_direct_segments(&img);
+	split_zero_runs(&img);
+	pack_segments(&img);
+
+	/* only stubs with the LZ decoder can take compressed entries */
+	for (i = 0; i < img.nr_segments; i++) {
+		if (img.segments[i].flags & DOLREL_SECT_LZ)
+			reloc_flags |= DOLREL_FLAG_LZ;
+	}
+
+	sdre_image = load_releng(sdre_bin, reloc_flags, &sdre_size);
 
 	reloc_code_size = sdre_size - sizeof(struct dolrel_control);
 	reloc_code = sdre_image;
 
-	transform_dol(fout, fin);
+	transform_image(&out, fout, outfile, &img);
+	release_input(&in);
 
-	fclose(fout);
-	fclose(fin);
+	close(fout);
+	close(fin);
+
+	return 0;
 }
 